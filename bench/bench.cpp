@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "gen.hpp"
+#include "../src/parser.hpp"
+#include "../src/codegen.hpp"
+#include "../src/vm.hpp"
+
+// Throughput of the lexer and parser over synthetic sources of every shape.
+// Each (shape, phase) pair runs in a forked child so that its peak RSS is
+// its own; the child reports the best of `reps` timed runs through a pipe.
+
+enum Phase {
+    LEX,   // Lexer::nextToken until ENDMARKER
+    PARSE, // Parser over an already lexed TokenBuffer
+    FLAT,  // FlatParser over an already lexed TokenBuffer
+    SHARE, // Parser with sharing on, over an already lexed TokenBuffer
+    E2E,   // Parser straight from the source, in STREAM mode
+    CGEN,  // codegen::emit_c from a parsed tree to /dev/null
+    TREE,  // vm::Machine::eval_tree on a parsed tree
+    BCGEN, // vm::compile of a parsed tree
+    VM,    // vm::Machine::run of compiled code
+    PHASE_COUNT,
+};
+
+static const char* const phase_names[PHASE_COUNT] = {
+    "lex", "parse", "flat", "share", "e2e", "cgen", "tree", "bcgen", "vm",
+};
+
+struct Result {
+    double seconds = 0;
+    std::size_t bytes = 0;
+    std::size_t tokens = 0;
+    std::size_t nodes = 0;
+    long peak_rss_kb = 0;
+    bool ok = false;
+    bool skipped = false; // the phase can't run this input
+};
+
+struct Options {
+    std::size_t size = 16 << 20;
+    unsigned reps = 5;
+    uint64_t seed = 1;
+    std::vector<gen::Shape> shapes = gen::all_shapes();
+    std::string emit;     // write the source of the first shape here and stop
+    std::string save;     // write results here
+    std::string compare;  // baseline to compare against
+    double threshold = 5; // percent slowdown that counts as a regression
+};
+
+static
+void usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [--size MiB] [--reps N] [--seed N] [--shape NAME]...\n"
+              << "       [--emit FILE] [--save FILE] [--compare FILE] [--threshold PERCENT]\n"
+              << "shapes:";
+    for (gen::Shape s : gen::all_shapes())
+        std::cerr << ' ' << gen::shape_name(s);
+    std::cerr << '\n';
+}
+
+static
+bool parse_args(int argc, char** argv, Options& opts) {
+    bool shape_given = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 == argc)
+            return false;
+        const char* val = argv[++i];
+        if (arg == "--size") {
+            opts.size = std::stod(val) * (1 << 20);
+        } else if (arg == "--reps") {
+            opts.reps = std::max(1ul, std::stoul(val));
+        } else if (arg == "--seed") {
+            opts.seed = std::stoull(val);
+        } else if (arg == "--shape") {
+            gen::Shape shape;
+            if (!gen::shape_from_name(val, shape))
+                return false;
+            if (!shape_given)
+                opts.shapes.clear();
+            shape_given = true;
+            opts.shapes.push_back(shape);
+        } else if (arg == "--emit") {
+            opts.emit = val;
+        } else if (arg == "--save") {
+            opts.save = val;
+        } else if (arg == "--compare") {
+            opts.compare = val;
+        } else if (arg == "--threshold") {
+            opts.threshold = std::stod(val);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Measuring
+ */
+
+static
+long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Runs `fn` `reps` times and returns the fastest run in seconds. A `fn`
+// that returns a double times itself, to leave out its setup.
+template <class Fn>
+static
+double best_of(unsigned reps, Fn fn) {
+    double best = INFINITY;
+    for (unsigned i = 0; i < reps; i++) {
+        if constexpr (std::is_same_v<decltype(fn()), double>) {
+            best = std::min(best, fn());
+        } else {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+            best = std::min(best, took.count());
+        }
+    }
+    return best;
+}
+
+// Keeps the optimizer from dropping work whose result is unused.
+template <class T>
+static inline
+void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+static
+Result measure(gen::Shape shape, Phase phase, const Options& opts) {
+    std::string src = gen::generate(shape, opts.size, opts.seed);
+    auto ignore = [](AST::FilePos, std::string) {};
+
+    Result res;
+    res.bytes = src.size();
+    res.tokens = Lexer(src, ignore).tokenize().size();
+    res.nodes = FlatParser(src, ignore, ParseMode::BUFFERED).parse_program().size();
+
+    switch (phase) {
+        case LEX:
+            res.seconds = best_of(opts.reps, [&] {
+                Lexer lexer(src, ignore);
+                LexTok tok;
+                do {
+                    tok = lexer.nextToken();
+                    keep(tok);
+                } while (tok.type != Token::ENDMARKER);
+            });
+            break;
+        case PARSE:
+            res.seconds = best_of(opts.reps, [&] {
+                TokenBuffer toks = Lexer(src, ignore).tokenize();
+                auto start = std::chrono::steady_clock::now();
+                AST::Program* prog = Parser(std::move(toks), ignore).parse_program();
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+                delete prog;
+                return took.count();
+            });
+            break;
+        case FLAT:
+            res.seconds = best_of(opts.reps, [&] {
+                TokenBuffer toks = Lexer(src, ignore).tokenize();
+                auto start = std::chrono::steady_clock::now();
+                AST::Flat::Tree tree = FlatParser(std::move(toks), ignore).parse_program();
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+                keep(tree);
+                return took.count();
+            });
+            break;
+        case SHARE:
+            res.seconds = best_of(opts.reps, [&] {
+                TokenBuffer toks = Lexer(src, ignore).tokenize();
+                auto start = std::chrono::steady_clock::now();
+                Parser parser(std::move(toks), ignore);
+                parser.set_sharing(true);
+                AST::Program* prog = parser.parse_program();
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+                delete prog;
+                return took.count();
+            });
+            break;
+        case E2E:
+            res.seconds = best_of(opts.reps, [&] {
+                delete Parser(src, ignore).parse_program();
+            });
+            break;
+        case CGEN: {
+            AST::Program* prog = Parser(src, ignore, ParseMode::BUFFERED).parse_program();
+            int fd = open("/dev/null", O_WRONLY);
+            res.seconds = best_of(opts.reps, [&] {
+                Writer out(fd);
+                codegen::emit_c(prog, out);
+            });
+            close(fd);
+            delete prog;
+            break;
+        }
+        case TREE:
+        case BCGEN:
+        case VM: {
+            // Only inputs that evaluate without error, like the arith shape.
+            AST::Program* prog = Parser(src, ignore, ParseMode::BUFFERED).parse_program();
+            vm::Machine machine;
+            vm::Chunk chunk;
+            vm::Value value;
+            std::string err;
+            bool ok = vm::compile(prog, chunk, err) && machine.run(chunk, value, err);
+            if (ok && phase == TREE) {
+                res.seconds = best_of(opts.reps, [&] { machine.eval_tree(prog, value, err); });
+            } else if (ok && phase == BCGEN) {
+                res.seconds = best_of(opts.reps, [&] { vm::compile(prog, chunk, err); });
+            } else if (ok) {
+                res.seconds = best_of(opts.reps, [&] { machine.run(chunk, value, err); });
+            }
+            res.skipped = !ok;
+            delete prog;
+            break;
+        }
+        default:
+            break;
+    }
+    res.peak_rss_kb = peak_rss_kb();
+    res.ok = true;
+    return res;
+}
+
+// Runs measure() in a child process; a crashed child gives a result with ok unset.
+static
+Result measure_isolated(gen::Shape shape, Phase phase, const Options& opts) {
+    Result res;
+    int fds[2];
+    if (pipe(fds) != 0)
+        return res;
+    std::fflush(nullptr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return res;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        Result r = measure(shape, phase, opts);
+        ssize_t n = write(fds[1], &r, sizeof r);
+        _exit(n == sizeof r ? 0 : 1);
+    }
+    close(fds[1]);
+    if (read(fds[0], &res, sizeof res) != sizeof res)
+        res = Result();
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        res.ok = false;
+    return res;
+}
+
+/*
+ * Reporting
+ */
+
+struct Row {
+    std::string shape;
+    std::string phase;
+    double mb_s;
+    double tokens_s;
+    double nodes_s;
+    long rss_kb;
+};
+
+static
+Row make_row(gen::Shape shape, Phase phase, const Result& r) {
+    return Row{
+        std::string(gen::shape_name(shape)), phase_names[phase],
+        r.bytes / r.seconds / 1e6, r.tokens / r.seconds,
+        phase == LEX ? 0 : r.nodes / r.seconds, r.peak_rss_kb,
+    };
+}
+
+// Baselines are plain text, one row per line: shape phase MB/s tokens/s nodes/s rss_kb
+static
+bool save_rows(const std::string& path, const std::vector<Row>& rows) {
+    std::ofstream out(path);
+    for (const Row& r : rows)
+        out << r.shape << ' ' << r.phase << ' ' << r.mb_s << ' '
+            << r.tokens_s << ' ' << r.nodes_s << ' ' << r.rss_kb << '\n';
+    return bool(out);
+}
+
+static
+bool load_rows(const std::string& path, std::map<std::string, Row>& rows) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    Row r;
+    while (in >> r.shape >> r.phase >> r.mb_s >> r.tokens_s >> r.nodes_s >> r.rss_kb)
+        rows[r.shape + ' ' + r.phase] = r;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!opts.emit.empty()) {
+        std::ofstream out(opts.emit, std::ios::binary);
+        out << gen::generate(opts.shapes.front(), opts.size, opts.seed);
+        return out ? 0 : 1;
+    }
+
+    std::map<std::string, Row> baseline;
+    if (!opts.compare.empty() && !load_rows(opts.compare, baseline)) {
+        std::cerr << "cannot read baseline " << opts.compare << '\n';
+        return 2;
+    }
+
+    std::printf("scanner: %s, input: %.1f MiB per shape, best of %u\n\n",
+                scan::active() == scan::Impl::AVX2 ? "avx2" :
+                scan::active() == scan::Impl::SSE2 ? "sse2" : "scalar",
+                opts.size / double(1 << 20), opts.reps);
+    std::printf("%-8s %-6s %10s %12s %12s %10s", "shape", "phase", "MB/s", "tokens/s", "nodes/s", "peak RSS");
+    if (!baseline.empty())
+        std::printf(" %9s", "vs base");
+    std::printf("\n");
+
+    std::vector<Row> rows;
+    int regressions = 0;
+    bool failed = false;
+    for (gen::Shape shape : opts.shapes) {
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            Result r = measure_isolated(shape, Phase(p), opts);
+            if (!r.ok) {
+                std::printf("%-8s %-6s failed\n", gen::shape_name(shape).data(), phase_names[p]);
+                failed = true;
+                continue;
+            }
+            if (r.skipped)
+                continue;
+            Row row = make_row(shape, Phase(p), r);
+            std::printf("%-8s %-6s %10.1f %12.4g ", row.shape.c_str(), row.phase.c_str(),
+                        row.mb_s, row.tokens_s);
+            if (row.nodes_s)
+                std::printf("%12.4g", row.nodes_s);
+            else
+                std::printf("%12s", "-");
+            std::printf(" %6ld MiB", row.rss_kb / 1024);
+            auto it = baseline.find(row.shape + ' ' + row.phase);
+            if (it != baseline.end()) {
+                double change = (row.mb_s / it->second.mb_s - 1) * 100;
+                bool slower = change < -opts.threshold;
+                regressions += slower;
+                std::printf(" %+8.1f%%%s", change, slower ? "  REGRESSION" : "");
+            }
+            std::printf("\n");
+            rows.push_back(row);
+        }
+    }
+
+    if (!opts.save.empty() && !save_rows(opts.save, rows)) {
+        std::cerr << "cannot write " << opts.save << '\n';
+        return 2;
+    }
+    if (regressions)
+        std::printf("\n%d result(s) more than %.1f%% slower than %s\n",
+                    regressions, opts.threshold, opts.compare.c_str());
+    return failed || regressions ? 1 : 0;
+}
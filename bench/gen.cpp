@@ -0,0 +1,281 @@
+#include "gen.hpp"
+#include <iterator>
+
+using gen::Shape;
+
+namespace {
+
+// splitmix64: tiny, fast, and unlike the <random> distributions it gives
+// the same numbers with every standard library.
+class Rng {
+    uint64_t state;
+public:
+    explicit Rng(uint64_t seed) : state(seed) {}
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    // in [0, n)
+    uint64_t below(uint64_t n) { return next() % n; }
+    // in [lo, hi]
+    uint64_t between(uint64_t lo, uint64_t hi) { return lo + below(hi - lo + 1); }
+};
+
+const char* const words[] = {
+    "alpha", "beta", "gamma", "delta", "count", "index", "value", "result",
+    "total", "offset", "length", "buffer", "node", "left", "right", "x", "y", "i",
+};
+
+const char* const binary_ops[] = {
+    "+", "-", "*", "/", "==", "!=", "<", ">", "<=", ">=", "&&", "||",
+};
+
+const char* const unary_ops[] = { "-", "+", "!" };
+
+template <class T, std::size_t N>
+const T& pick(Rng& rng, const T (&arr)[N]) {
+    return arr[rng.below(N)];
+}
+
+void ident(Rng& rng, std::string& out) {
+    out += pick(rng, words);
+    if (rng.below(4) != 0) {
+        out += '_';
+        out += std::to_string(rng.below(1000));
+    }
+}
+
+void literal(Rng& rng, std::string& out) {
+    static const char hex[] = "0123456789abcdef";
+    switch (rng.below(4)) {
+        case 0:
+            out += std::to_string(rng.below(1000000));
+            break;
+        case 1:
+            out += "0x";
+            for (int n = rng.between(1, 8); n > 0; n--)
+                out += hex[rng.below(16)];
+            break;
+        case 2:
+            out += std::to_string(rng.below(10000));
+            out += '.';
+            out += std::to_string(rng.below(1000));
+            break;
+        default:
+            out += std::to_string(rng.between(1, 9));
+            out += 'e';
+            out += std::to_string(rng.below(300));
+            break;
+    }
+}
+
+void string_lit(Rng& rng, std::string& out, std::size_t min_len, std::size_t max_len) {
+    static const char text[] = "the quick brown fox jumps over the lazy dog 0123456789 {}";
+    out += '"';
+    for (std::size_t n = rng.between(min_len, max_len); n > 0; n--)
+        out += text[rng.below(sizeof text - 1)];
+    if (rng.below(4) == 0)
+        out += "\\n";
+    out += '"';
+}
+
+void ident_line(Rng& rng, std::string& out) {
+    ident(rng, out);
+    for (int n = rng.between(4, 16); n > 0; n--) {
+        out += ' ';
+        out += pick(rng, binary_ops);
+        out += ' ';
+        ident(rng, out);
+    }
+    out += '\n';
+}
+
+void literal_line(Rng& rng, std::string& out) {
+    literal(rng, out);
+    for (int n = rng.between(4, 16); n > 0; n--) {
+        out += rng.below(2) ? " + " : " * ";
+        literal(rng, out);
+    }
+    out += '\n';
+}
+
+void nested_line(Rng& rng, std::string& out) {
+    // a deep unary chain followed by a long binary chain
+    for (int n = rng.between(16, 64); n > 0; n--) {
+        out += pick(rng, unary_ops);
+        out += ' ';
+    }
+    ident(rng, out);
+    for (int n = rng.between(32, 128); n > 0; n--) {
+        out += ' ';
+        out += pick(rng, binary_ops);
+        out += ' ';
+        if (rng.below(3) == 0)
+            out += "- ";
+        if (rng.below(2))
+            ident(rng, out);
+        else
+            literal(rng, out);
+    }
+    out += '\n';
+}
+
+void string_line(Rng& rng, std::string& out) {
+    string_lit(rng, out, 200, 2000);
+    out += '\n';
+}
+
+void comment_line(Rng& rng, std::string& out) {
+    out += "// ";
+    out.append(rng.between(40, 100), '=');
+    out += "\n// ";
+    for (int n = rng.between(5, 15); n > 0; n--) {
+        out += pick(rng, words);
+        out += ' ';
+    }
+    out += "\n// ";
+    out.append(rng.between(40, 100), '=');
+    out += '\n';
+    ident(rng, out);
+    out += " + 1 // trailing comment\n";
+}
+
+// factor := [-] (int | name | float)
+void arith_factor(Rng& rng, std::string& out) {
+    if (rng.below(5) == 0)
+        out += "- ";
+    switch (rng.below(6)) {
+        case 0:
+            ident(rng, out);
+            break;
+        case 1:
+            out += std::to_string(rng.below(100));
+            out += '.';
+            out += std::to_string(rng.below(10));
+            break;
+        default:
+            out += std::to_string(rng.below(100));
+            break;
+    }
+}
+
+// term := factor [* factor]
+void arith_term(Rng& rng, std::string& out) {
+    arith_factor(rng, out);
+    if (rng.below(2)) {
+        out += " * ";
+        arith_factor(rng, out);
+    }
+}
+
+void arith_sum(Rng& rng, std::string& out) {
+    arith_term(rng, out);
+    for (int n = rng.between(1, 8); n > 0; n--) {
+        out += rng.below(2) ? " + " : " - ";
+        arith_term(rng, out);
+    }
+}
+
+void arith_line(Rng& rng, std::string& out) {
+    static const char* const cmp_ops[] = { " < ", " > ", " <= ", " >= ", " == ", " != " };
+    for (int n = rng.between(1, 3); n > 0; n--) {
+        arith_sum(rng, out);
+        if (rng.below(2)) {
+            out += pick(rng, cmp_ops);
+            arith_sum(rng, out);
+        }
+        if (n > 1)
+            out += rng.below(2) ? " && " : " || ";
+    }
+    out += '\n';
+}
+
+// A prefix chain far deeper than the nested shape's, then a long binary
+// chain whose operands have short prefix chains of their own.
+void deep_line(Rng& rng, std::string& out) {
+    for (int n = rng.between(100000, 200000); n > 0; n--) {
+        out += pick(rng, unary_ops);
+        out += ' ';
+    }
+    ident(rng, out);
+    for (int n = rng.between(10000, 20000); n > 0; n--) {
+        out += ' ';
+        out += pick(rng, binary_ops);
+        out += ' ';
+        for (int k = rng.below(4); k > 0; k--)
+            out += "! ";
+        ident(rng, out);
+    }
+    out += '\n';
+}
+
+// One of 32 fixed ident lines.
+void repeat_line(Rng& rng, std::string& out) {
+    Rng fixed(rng.below(32) + 1);
+    ident_line(fixed, out);
+}
+
+void line(Shape shape, Rng& rng, std::string& out) {
+    switch (shape) {
+        case Shape::IDENT:   ident_line(rng, out); break;
+        case Shape::LITERAL: literal_line(rng, out); break;
+        case Shape::NESTED:  nested_line(rng, out); break;
+        case Shape::STRING:  string_line(rng, out); break;
+        case Shape::COMMENT: comment_line(rng, out); break;
+        case Shape::ARITH:   arith_line(rng, out); break;
+        case Shape::DEEP:    deep_line(rng, out); break;
+        case Shape::REPEAT:  repeat_line(rng, out); break;
+        case Shape::MIXED: {
+            static const Shape shapes[] = {
+                Shape::IDENT, Shape::LITERAL, Shape::NESTED, Shape::STRING, Shape::COMMENT,
+            };
+            line(pick(rng, shapes), rng, out);
+            if (rng.below(8) == 0)
+                out += '\n';
+            break;
+        }
+    }
+}
+
+}
+
+std::vector<Shape> gen::all_shapes() {
+    return {Shape::IDENT, Shape::LITERAL, Shape::NESTED, Shape::STRING, Shape::COMMENT, Shape::MIXED,
+            Shape::ARITH, Shape::DEEP, Shape::REPEAT};
+}
+
+std::string_view gen::shape_name(Shape shape) {
+    switch (shape) {
+        case Shape::IDENT:   return "ident";
+        case Shape::LITERAL: return "literal";
+        case Shape::NESTED:  return "nested";
+        case Shape::STRING:  return "string";
+        case Shape::COMMENT: return "comment";
+        case Shape::MIXED:   return "mixed";
+        case Shape::ARITH:   return "arith";
+        case Shape::DEEP:    return "deep";
+        case Shape::REPEAT:  return "repeat";
+    }
+    return "?";
+}
+
+bool gen::shape_from_name(std::string_view name, Shape& shape) {
+    for (Shape s : all_shapes()) {
+        if (shape_name(s) == name) {
+            shape = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string gen::generate(Shape shape, std::size_t bytes, uint64_t seed) {
+    Rng rng(seed);
+    std::string out;
+    out.reserve(bytes + 4096);
+    while (out.size() < bytes)
+        line(shape, rng, out);
+    return out;
+}
@@ -0,0 +1,36 @@
+#ifndef GEN_HPP
+#define GEN_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Deterministic generator of synthetic Panda sources for benchmarking.
+// The same shape, size and seed always give the same bytes, on any platform.
+namespace gen {
+
+    enum class Shape {
+        IDENT,    // long expressions over many distinct identifiers
+        LITERAL,  // int, hex and float literals
+        NESTED,   // deep unary chains and long mixed-precedence chains
+        STRING,   // long string literals
+        COMMENT,  // comment banners between short statements
+        MIXED,    // all of the above, line by line
+        ARITH,    // small-valued arithmetic and logic that evaluates without
+                  // overflow or division, for the evaluators
+        DEEP,     // statements nested hundreds of thousands deep
+        REPEAT,   // the same few dozen statements over and over, as in
+                  // generated code; what --share saves memory on
+    };
+
+    std::vector<Shape> all_shapes();
+    std::string_view shape_name(Shape shape);
+    // Returns false if `name` is not a shape.
+    bool shape_from_name(std::string_view name, Shape& shape);
+
+    // Generates at least `bytes` bytes of source, ending with a newline.
+    std::string generate(Shape shape, std::size_t bytes, uint64_t seed = 1);
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include "arena.hpp"
+#include <cstdlib>
+#include "stats.hpp"
+
+
+// Blocks double in size up to max_block, so a tree of n bytes takes
+// O(log n) blocks and at most max_block bytes are left unused at the end.
+static constexpr std::size_t min_block = 16 * 1024;
+static constexpr std::size_t max_block = 16 * 1024 * 1024;
+
+void Arena::grow(std::size_t size, std::size_t align) {
+    std::size_t want = head ? head->size * 2 : min_block;
+    if (want > max_block)
+        want = max_block;
+    if (want < size + align)
+        want = size + align;
+
+    // The header is followed by the data; its size keeps max_align_t alignment.
+    constexpr std::size_t header = (sizeof(Block) + alignof(std::max_align_t) - 1)
+                                   & ~(alignof(std::max_align_t) - 1);
+    void* mem = std::malloc(header + want);
+    if (!mem)
+        throw std::bad_alloc();
+    stats::note_alloc(header + want);
+
+    Block* block = static_cast<Block*>(mem);
+    block->prev = head;
+    block->size = want;
+    head = block;
+    reserved += header + want;
+
+    cur = static_cast<char*>(mem) + header;
+    end = cur + want;
+}
+
+Arena::~Arena() {
+    while (head) {
+        Block* prev = head->prev;
+        std::free(head);
+        head = prev;
+    }
+}
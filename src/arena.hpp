@@ -0,0 +1,66 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A bump allocator. Objects are carved out of large blocks and are never
+// destroyed individually; all of the memory is released at once when the
+// Arena itself is destroyed. Only trivially destructible types may be
+// allocated from it, since their destructors would never run.
+class Arena {
+    struct Block {
+        Block* prev;
+        std::size_t size; // usable bytes after the header
+    };
+
+    char* cur = nullptr;
+    char* end = nullptr;
+    Block* head = nullptr;
+    std::size_t used = 0;
+    std::size_t reserved = 0;
+
+    // Start a new block that fits at least `size` bytes aligned to `align`.
+    void grow(std::size_t size, std::size_t align);
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena();
+
+    void* allocate(std::size_t size, std::size_t align) {
+        std::size_t pad = -reinterpret_cast<std::size_t>(cur) & (align - 1);
+        if (size + pad > std::size_t(end - cur)) {
+            grow(size, align);
+            pad = -reinterpret_cast<std::size_t>(cur) & (align - 1);
+        }
+        char* p = cur + pad;
+        cur = p + size;
+        used += size;
+        return p;
+    }
+
+    // Gives back the last allocation, if `p` of `size` bytes is it;
+    // anything else stays allocated.
+    void undo(void* p, std::size_t size) {
+        if (static_cast<char*>(p) + size == cur) {
+            cur = static_cast<char*>(p);
+            used -= size;
+        }
+    }
+
+    template <class T, class... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>,
+                      "objects in an Arena are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Bytes handed out so far, and bytes taken from the system.
+    std::size_t bytes_used() const { return used; }
+    std::size_t bytes_reserved() const { return reserved; }
+};
+
+#endif
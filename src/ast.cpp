@@ -1,9 +1,12 @@
 #include "ast.hpp" 
+#include "scan.hpp"
+#include <algorithm>
 
 AST::FilePos AST::FilePos_from_offset(std::size_t offs, std::string_view input) {
     AST::FilePos pos {1, 1};
+    std::size_t end = std::min(offs, input.size());
 
-    for (int i = 0; i <= offs; i++) {
+    for (std::size_t i = 0; i < end; i++) {
         if (input[i] == '\n') {
             pos.row += 1;
             pos.col = 1;
@@ -13,4 +16,68 @@ AST::FilePos AST::FilePos_from_offset(std::size_t offs, std::string_view input)
     }
 
     return pos;
-}
\ No newline at end of file
+}
+
+AST::LineTable::LineTable(std::string_view input) : size(input.size()) {
+    const char* begin = input.data();
+    const char* end = begin + input.size();
+    starts.push_back(0);
+    for (const char* p = scan::line(begin, end); p != end; p = scan::line(p + 1, end))
+        starts.push_back(p + 1 - begin);
+}
+
+AST::FilePos AST::LineTable::pos(std::size_t offs) const {
+    offs = std::min(offs, size);
+    // The last line starting at or before offs.
+    auto line = std::upper_bound(starts.begin(), starts.end(), offs) - 1;
+    return {std::size_t(line - starts.begin()) + 1, offs - *line + 1};
+}
+
+uint64_t AST::shallow_hash(Expr* e) {
+    uint64_t h = cons::mix(0, e->type());
+    switch (e->type()) {
+        case EXPR_LIT_STRING: {
+            std::string_view s = static_cast<StringLit*>(e)->value;
+            return cons::mix(h, cons::bytes(s.data(), s.size()));
+        }
+        case EXPR_LIT_INT:   return cons::mix(h, static_cast<IntLit*>(e)->value);
+        case EXPR_LIT_FLOAT: return cons::mix(h, cons::bits(static_cast<FloatLit*>(e)->value));
+        case EXPR_LIT_IDENT: return cons::mix(h, static_cast<IdentLit*>(e)->name);
+        case EXPR_UNARY: {
+            ExprUnary* x = static_cast<ExprUnary*>(e);
+            return cons::mix(cons::mix(h, uint64_t(x->op)), reinterpret_cast<uintptr_t>(x->right));
+        }
+        case EXPR_BINARY: {
+            ExprBinary* x = static_cast<ExprBinary*>(e);
+            h = cons::mix(cons::mix(h, uint64_t(x->op)), reinterpret_cast<uintptr_t>(x->left));
+            return cons::mix(h, reinterpret_cast<uintptr_t>(x->right));
+        }
+        default:
+            return h;
+    }
+}
+
+bool AST::shallow_equal(Expr* a, Expr* b) {
+    if (a->type() != b->type())
+        return false;
+    switch (a->type()) {
+        case EXPR_LIT_STRING: return static_cast<StringLit*>(a)->value == static_cast<StringLit*>(b)->value;
+        case EXPR_LIT_INT:    return static_cast<IntLit*>(a)->value == static_cast<IntLit*>(b)->value;
+        // By bits, so that 0.0 and -0.0 stay apart and a NaN equals itself.
+        case EXPR_LIT_FLOAT:
+            return cons::bits(static_cast<FloatLit*>(a)->value) == cons::bits(static_cast<FloatLit*>(b)->value);
+        case EXPR_LIT_IDENT:  return static_cast<IdentLit*>(a)->name == static_cast<IdentLit*>(b)->name;
+        case EXPR_UNARY: {
+            ExprUnary* x = static_cast<ExprUnary*>(a);
+            ExprUnary* y = static_cast<ExprUnary*>(b);
+            return x->op == y->op && x->right == y->right;
+        }
+        case EXPR_BINARY: {
+            ExprBinary* x = static_cast<ExprBinary*>(a);
+            ExprBinary* y = static_cast<ExprBinary*>(b);
+            return x->op == y->op && x->left == y->left && x->right == y->right;
+        }
+        default:
+            return true;
+    }
+}
@@ -1,9 +1,18 @@
 #ifndef AST_HPP
 #define AST_HPP
 #include <iostream>
+#include <string>
 #include <vector>
+#include <string_view>
 #include <cstdint>
+#include <utility>
+#include <functional>
+#include <memory>
 #include "token.hpp"
+#include "arena.hpp"
+#include "symbol.hpp"
+#include "fold.hpp"
+#include "cons.hpp"
 
 namespace AST {
 
@@ -24,47 +33,45 @@ namespace AST {
         EXPR_BINARY,
         EXPR_BAD,
     };
+    // Nodes carry their type as a plain tag rather than a vtable, and
+    // passes dispatch on it with a switch; see visitor.hpp.
     struct Node {
     private:
         std::size_t location;
+        NodeType kind;
     public:
-        explicit Node(std::size_t location)
-        : location(location) {}
+        explicit Node(std::size_t location, NodeType kind)
+        : location(location), kind(kind) {}
         std::size_t pos() { return location; };
-        virtual std::string string() = 0;
-        virtual NodeType type() = 0;
-        virtual ~Node() { };
+        NodeType type() const { return kind; }
+        // The node in PrintFormat::HUMAN; see Printer in printer.hpp.
+        std::string string();
+    protected:
+        // Nodes live in their Program's arena and are never deleted
+        // one by one, so they have no virtual destructor.
+        ~Node() = default;
     };
 
     struct Stmt : public Node {
-        explicit Stmt(std::size_t location)
-        : Node(location) {};
-        virtual std::string string() = 0;
-        virtual NodeType type() = 0;
+        explicit Stmt(std::size_t location, NodeType kind)
+        : Node(location, kind) {};
     };
 
     struct Expr : public Node {
-        explicit Expr(std::size_t location)
-        : Node(location) {}
-        virtual std::string string() = 0;
-        virtual NodeType type() = 0;
+        explicit Expr(std::size_t location, NodeType kind)
+        : Node(location, kind) {}
     };
 
-    struct Program : public Node {
+    // The root of the tree. It owns the arena that every other node of the
+    // tree is allocated from, so deleting the Program frees the whole tree.
+    struct Program final : public Node {
         std::vector<Stmt*> stmts;
+        Arena arena;
+        // Built with sharing on: equal subtrees are the same node, so the
+        // tree is a DAG and comparing two Expr* compares their subtrees.
+        bool shared = false;
 
-        Program() : Node(0) {}
-        ~Program() {
-            for (Stmt* stmt : stmts)
-                delete stmt;
-        }
-    
-        std::string string() override {
-            std::string s;
-            for (Stmt* stmt : stmts) s += stmt->string();
-            return s;
-        }
-        NodeType type() override { return NODE_PROGRAM; }
+        Program() : Node(0, NODE_PROGRAM) {}
 
     };
 
@@ -72,53 +79,47 @@ namespace AST {
     /* 
      * Exprs
      */
+    // StringLit refers to its spelling in the source buffer rather than
+    // owning a copy, so the source must outlive the tree.
     struct StringLit : public Expr {
-        std::string value;
+        std::string_view value;
 
-        explicit StringLit(std::size_t pos) : Expr(pos) {}
-        explicit StringLit(std::string value, std::size_t pos)
-        : Expr(pos), value(value) {}
-        std::string string() override { return value; }
-        NodeType type() override { return EXPR_LIT_STRING; }
+        explicit StringLit(std::size_t pos) : Expr(pos, EXPR_LIT_STRING) {}
+        explicit StringLit(std::string_view value, std::size_t pos)
+        : Expr(pos, EXPR_LIT_STRING), value(value) {}
     };
 
     struct IntLit : public Expr {
         int64_t value;
 
-        explicit IntLit(std::size_t pos) : Expr(pos) {}
+        explicit IntLit(std::size_t pos) : Expr(pos, EXPR_LIT_INT) {}
         explicit IntLit(int64_t value, std::size_t pos)
-        : Expr(pos), value(value) {}
-        std::string string() override { return std::to_string(value); }
-        NodeType type() override { return EXPR_LIT_INT; }
+        : Expr(pos, EXPR_LIT_INT), value(value) {}
     };
 
     struct FloatLit : public Expr {
         double value;
 
-        explicit FloatLit(std::size_t pos) : Expr(pos) {}
+        explicit FloatLit(std::size_t pos) : Expr(pos, EXPR_LIT_FLOAT) {}
         explicit FloatLit(double value, std::size_t pos)
-        : Expr(pos), value(value) {}
-        std::string string() override { return std::to_string(value); }
-        NodeType type() override { return EXPR_LIT_FLOAT; }
+        : Expr(pos, EXPR_LIT_FLOAT), value(value) {}
     };
 
+    // Names are interned in SymbolTable::global().
     struct IdentLit : public Expr {
-        std::string value;
+        Symbol name;
 
-        explicit IdentLit(std::size_t pos) : Expr(pos) {}
-        explicit IdentLit(std::string value, std::size_t pos)
-        : Expr(pos), value(value) {}
-        std::string string() override { return value; }
-        NodeType type() override { return EXPR_LIT_IDENT; }
+        explicit IdentLit(std::size_t pos) : Expr(pos, EXPR_LIT_IDENT) {}
+        explicit IdentLit(Symbol name, std::size_t pos)
+        : Expr(pos, EXPR_LIT_IDENT), name(name) {}
+        std::string_view spelling() const { return SymbolTable::global().spelling(name); }
     };
 
     struct ExprUnary : public Expr {
         Token op;
         Expr *right;
 
-        explicit ExprUnary(std::size_t pos) : Expr(pos) {}
-        std::string string() override { return token_string[op] + ' ' + right->string(); }
-        NodeType type() override { return EXPR_UNARY; }
+        explicit ExprUnary(std::size_t pos) : Expr(pos, EXPR_UNARY) {}
     };
 
     struct ExprBinary : public Expr {
@@ -126,17 +127,11 @@ namespace AST {
         Token op;
         Expr *right;
 
-        explicit ExprBinary(std::size_t pos) : Expr(pos) {}
-        std::string string() override { 
-            return left->string() + ' ' + token_string[op] + ' ' + right->string();
-        }
-        NodeType type() override { return EXPR_BINARY; }
+        explicit ExprBinary(std::size_t pos) : Expr(pos, EXPR_BINARY) {}
     };
 
     struct ExprBad : public Expr {
-        std::string string() override { return "<INVALID EXPRESSION>"; }
-        explicit ExprBad(std::size_t pos) : Expr(pos) {}
-        NodeType type() override { return EXPR_BAD; }
+        explicit ExprBad(std::size_t pos) : Expr(pos, EXPR_BAD) {}
     };
     /*
      * Statements
@@ -145,16 +140,129 @@ namespace AST {
     struct StmtExpr : public Stmt {
         Expr *expr;
 
-        explicit StmtExpr(std::size_t pos) : Stmt(pos) {} 
-        std::string string() override { return expr->string() + '\n'; }
-        NodeType type() override { return STMT_EXPR; }
+        explicit StmtExpr(std::size_t pos) : Stmt(pos, STMT_EXPR) {} 
+    };
+
+    // A hash of an expression's own fields, with its children taken by
+    // identity, and the matching comparison; for ConsTable.
+    uint64_t shallow_hash(Expr* e);
+    bool shallow_equal(Expr* a, Expr* b);
+
+    /*
+     * Builders
+     */
+
+    // Builds the pointer-based tree for BasicParser, allocating every node
+    // from the arena of the Program being built. Other builders provide the
+    // same members with their own Expr/Stmt handle types.
+    class TreeBuilder {
+        struct Hash { uint64_t operator()(AST::Expr* e) const { return shallow_hash(e); } };
+        struct Equal { bool operator()(AST::Expr* a, AST::Expr* b) const { return shallow_equal(a, b); } };
+        using Table = ConsTable<AST::Expr*, Hash, Equal>;
+
+        Program* prog = nullptr;
+        bool m_share = false;
+        std::unique_ptr<Table> table; // while sharing
+
+        template <class T, class... Args>
+        T* make(Args&&... args) { return prog->arena.make<T>(std::forward<Args>(args)...); }
+        // The canonical node equal to the new `e`, which is given back if
+        // it is not the first.
+        template <class T>
+        AST::Expr* share(T* e) {
+            if (!table)
+                return e;
+            bool found;
+            AST::Expr* c = table->intern(e, found);
+            if (found)
+                prog->arena.undo(e, sizeof(T));
+            return c;
+        }
+    public:
+        using Expr = AST::Expr*;
+        using Stmt = AST::Stmt*;
+        using Result = Program*;
+        static constexpr std::size_t max_input = SIZE_MAX;
+
+        // With sharing on, every expression but ExprBad is made once and
+        // equal ones refer to it; a shared node keeps the position of its
+        // first occurrence.
+        void set_sharing(bool on) { m_share = on; }
+
+        void begin(std::string_view) {
+            prog = new Program();
+            table.reset(m_share ? new Table() : nullptr);
+        }
+        Expr ident(std::size_t pos, std::string_view name) {
+            return share(make<IdentLit>(SymbolTable::global().intern(name), pos));
+        }
+        Expr string(std::size_t pos, std::string_view value) { return share(make<StringLit>(value, pos)); }
+        Expr int_lit(std::size_t pos, int64_t value) { return share(make<IntLit>(value, pos)); }
+        Expr float_lit(std::size_t pos, double value) { return share(make<FloatLit>(value, pos)); }
+        // Never shared: each one marks an error at its own position.
+        Expr bad(std::size_t pos) { return make<ExprBad>(pos); }
+        Expr unary(std::size_t pos, Token op, Expr right) {
+            ExprUnary* x = make<ExprUnary>(pos);
+            x->op = op;
+            x->right = right;
+            return share(x);
+        }
+        Expr binary(std::size_t pos, Expr left, Token op, Expr right) {
+            ExprBinary* x = make<ExprBinary>(pos);
+            x->left = left;
+            x->op = op;
+            x->right = right;
+            return share(x);
+        }
+        // The value of a literal, for constant folding.
+        bool constant(Expr e, fold::Const& c) {
+            switch (e->type()) {
+                case EXPR_LIT_INT: c = fold::Const::of_int(static_cast<IntLit*>(e)->value); return true;
+                case EXPR_LIT_FLOAT: c = fold::Const::of_float(static_cast<FloatLit*>(e)->value); return true;
+                default: return false;
+            }
+        }
+        // Drops a literal that folding has replaced, giving its memory back
+        // when it is the last node made. A shared literal stays, as the
+        // table still holds it.
+        void discard(Expr e) {
+            if (!table)
+                prog->arena.undo(e, e->type() == EXPR_LIT_INT ? sizeof(IntLit) : sizeof(FloatLit));
+        }
+        Stmt stmt_expr(std::size_t pos, Expr expr) {
+            StmtExpr* stmt = make<StmtExpr>(pos);
+            stmt->expr = expr;
+            return stmt;
+        }
+        Result finish(std::vector<Stmt> stmts) {
+            prog->stmts = std::move(stmts);
+            prog->shared = table != nullptr;
+            table.reset();
+            return std::exchange(prog, nullptr);
+        }
     };
 
-    
     struct FilePos {
         std::size_t row;
         std::size_t col;
     };
+
+    // Receives the diagnostics of a Lexer or Parser.
+    using ErrorHandler = std::function<void(FilePos, std::string)>;
+
+    // Converts an offset into a position by scanning the input up to it.
+    // Use a LineTable when converting more than a handful of offsets.
     FilePos FilePos_from_offset(std::size_t offs, std::string_view input);
+
+    // The offset of the first byte of every line, built in one pass over
+    // the input. Converting an offset is then a binary search.
+    class LineTable {
+        std::vector<std::size_t> starts;
+        std::size_t size; // offsets past the end are clamped to it
+    public:
+        explicit LineTable(std::string_view input);
+        FilePos pos(std::size_t offs) const;
+        std::size_t lines() const { return starts.size(); }
+    };
 }
 #endif
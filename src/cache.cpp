@@ -0,0 +1,460 @@
+#include "cache.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "parser.hpp"
+#include "source.hpp"
+#include "stats.hpp"
+#include "writer.hpp"
+
+using namespace AST;
+
+
+/*
+ * Hashing: two lanes of 64x64->128 bit multiply-and-fold, 32 bytes a step.
+ */
+
+static inline
+uint64_t mix(uint64_t a, uint64_t b) {
+    __extension__ unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+    return uint64_t(r) ^ uint64_t(r >> 64);
+}
+
+static inline
+uint64_t load64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+uint64_t cache::hash(std::string_view data, uint64_t seed) {
+    constexpr uint64_t k0 = 0xa0761d6478bd642full, k1 = 0xe7037ed1a0b428dbull;
+    constexpr uint64_t k2 = 0x8ebc6af09c88c6e3ull, k3 = 0x589965cc75374cc3ull;
+    const char* p = data.data();
+    std::size_t n = data.size();
+    uint64_t a = seed ^ k0, b = seed ^ k1;
+    for (; n >= 32; p += 32, n -= 32) {
+        a = mix(load64(p) ^ k2, load64(p + 8) ^ a);
+        b = mix(load64(p + 16) ^ k3, load64(p + 24) ^ b);
+    }
+    // The rest, zero-padded to whole words.
+    char tail[32] = {};
+    std::memcpy(tail, p, n);
+    for (std::size_t i = 0; i < n; i += 16)
+        a = mix(load64(tail + i) ^ k2, load64(tail + i + 8) ^ a) ^ b;
+    return mix(a ^ k1 ^ data.size(), b ^ k3);
+}
+
+
+/*
+ * Entry layout: the header, then the sections below in order, each
+ * starting at a multiple of 8 bytes.
+ */
+
+static constexpr char magic[4] = {'P', 'D', 'A', 'C'};
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint64_t entry_hash; // of everything after the header
+    uint32_t flags;
+    uint32_t nodes;
+    uint32_t ints;
+    uint32_t floats;
+    uint32_t stmts;
+    uint32_t extra;      // bytes of spellings that are not in the source
+    uint32_t diags;
+    uint32_t diag_bytes; // bytes of diagnostic messages
+};
+
+static_assert(sizeof(Header) % 8 == 0, "the first section starts right after the header");
+
+struct DiagRecord {
+    uint32_t row;
+    uint32_t col;
+    uint32_t len;
+};
+
+struct Layout {
+    std::size_t ints, floats, data, pos, stmts, diags, types, ops, extra, diag_text, size;
+};
+
+static
+Layout layout(const Header& h) {
+    auto align = [](std::size_t n) { return (n + 7) & ~std::size_t(7); };
+    Layout l;
+    std::size_t at = align(sizeof(Header));
+    auto section = [&](std::size_t bytes) {
+        std::size_t start = at;
+        at = align(at + bytes);
+        return start;
+    };
+    l.ints = section(h.ints * sizeof(int64_t));
+    l.floats = section(h.floats * sizeof(double));
+    l.data = section(h.nodes * sizeof(Flat::Data));
+    l.pos = section(h.nodes * sizeof(uint32_t));
+    l.stmts = section(h.stmts * sizeof(Flat::Ref));
+    l.diags = section(h.diags * sizeof(DiagRecord));
+    l.types = section(h.nodes);
+    l.ops = section(h.nodes);
+    l.extra = section(h.extra);
+    l.diag_text = section(h.diag_bytes);
+    l.size = at;
+    return l;
+}
+
+// The rows of a tree, from a Flat::Tree or from an entry. Identifiers are
+// Symbols in the one and spans in the other.
+struct Rows {
+    Flat::Ref nodes, stmt_count, int_count, float_count;
+    const uint8_t* types;
+    const uint8_t* ops;
+    const uint32_t* pos;
+    const Flat::Data* data;
+    const int64_t* ints;
+    const double* floats;
+    const Flat::Ref* stmts;
+    std::string_view source, extra;
+    bool ident_spans;
+
+    std::string_view span(Flat::Data d) const {
+        if (d.lhs < source.size())
+            return source.substr(d.lhs, d.rhs);
+        return extra.substr(d.lhs - source.size(), d.rhs);
+    }
+};
+
+static
+Program* build(const Rows& r) {
+    Program* prog = new Program();
+    std::vector<Node*> nodes(r.nodes);
+    auto expr = [&](Flat::Ref n) { return static_cast<Expr*>(nodes[n]); };
+    for (Flat::Ref i = 0; i < r.nodes; i++) {
+        Flat::Data d = r.data[i];
+        std::size_t pos = r.pos[i];
+        switch (NodeType(r.types[i])) {
+            case EXPR_LIT_IDENT: {
+                Symbol name = r.ident_spans ? SymbolTable::global().intern(r.span(d)) : d.lhs;
+                nodes[i] = prog->arena.make<IdentLit>(name, pos);
+                break;
+            }
+            case EXPR_LIT_STRING: {
+                std::string_view s = r.span(d);
+                if (d.lhs >= r.source.size()) {
+                    // The entry goes away after loading; keep a copy.
+                    char* copy = static_cast<char*>(prog->arena.allocate(s.size(), 1));
+                    std::memcpy(copy, s.data(), s.size());
+                    s = std::string_view(copy, s.size());
+                }
+                nodes[i] = prog->arena.make<StringLit>(s, pos);
+                break;
+            }
+            case EXPR_LIT_INT:
+                nodes[i] = prog->arena.make<IntLit>(r.ints[d.lhs], pos);
+                break;
+            case EXPR_LIT_FLOAT:
+                nodes[i] = prog->arena.make<FloatLit>(r.floats[d.lhs], pos);
+                break;
+            case EXPR_UNARY: {
+                ExprUnary* x = prog->arena.make<ExprUnary>(pos);
+                x->op = Token(r.ops[i]);
+                x->right = expr(d.rhs);
+                nodes[i] = x;
+                break;
+            }
+            case EXPR_BINARY: {
+                ExprBinary* x = prog->arena.make<ExprBinary>(pos);
+                x->left = expr(d.lhs);
+                x->op = Token(r.ops[i]);
+                x->right = expr(d.rhs);
+                nodes[i] = x;
+                break;
+            }
+            case STMT_EXPR: {
+                StmtExpr* s = prog->arena.make<StmtExpr>(pos);
+                s->expr = expr(d.lhs);
+                nodes[i] = s;
+                break;
+            }
+            default:
+                nodes[i] = prog->arena.make<ExprBad>(pos);
+                break;
+        }
+    }
+    prog->stmts.reserve(r.stmt_count);
+    for (Flat::Ref i = 0; i < r.stmt_count; i++)
+        prog->stmts.push_back(static_cast<Stmt*>(nodes[r.stmts[i]]));
+    return prog;
+}
+
+static
+bool is_expr(uint8_t type) {
+    switch (type) {
+        case EXPR_LIT_STRING:
+        case EXPR_LIT_INT:
+        case EXPR_LIT_FLOAT:
+        case EXPR_LIT_IDENT:
+        case EXPR_UNARY:
+        case EXPR_BINARY:
+        case EXPR_BAD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Whether build() can use the rows of an entry safely: every node refers
+// only to nodes before it, of the right kind, and every index and span is
+// in range.
+static
+bool valid(const Rows& r) {
+    std::size_t text_size = r.source.size() + r.extra.size();
+    auto before = [&](Flat::Ref child, Flat::Ref n) { return child < n && is_expr(r.types[child]); };
+    auto is_op = [](uint8_t op) { return op < uint8_t(Token::_end_keywords); };
+    for (Flat::Ref i = 0; i < r.nodes; i++) {
+        Flat::Data d = r.data[i];
+        bool ok;
+        switch (r.types[i]) {
+            case EXPR_LIT_IDENT:
+            case EXPR_LIT_STRING:
+                // Within the source or within extra, not across the two.
+                ok = d.lhs < r.source.size() ? d.rhs <= r.source.size() - d.lhs
+                                             : d.lhs <= text_size && d.rhs <= text_size - d.lhs;
+                break;
+            case EXPR_LIT_INT:   ok = d.lhs < r.int_count; break;
+            case EXPR_LIT_FLOAT: ok = d.lhs < r.float_count; break;
+            case EXPR_UNARY:     ok = before(d.rhs, i) && is_op(r.ops[i]); break;
+            case EXPR_BINARY:    ok = before(d.lhs, i) && before(d.rhs, i) && is_op(r.ops[i]); break;
+            case STMT_EXPR:      ok = before(d.lhs, i); break;
+            case EXPR_BAD:       ok = true; break;
+            default:             ok = false; break;
+        }
+        if (!ok)
+            return false;
+    }
+    for (Flat::Ref i = 0; i < r.stmt_count; i++)
+        if (r.stmts[i] >= r.nodes || r.types[r.stmts[i]] != STMT_EXPR)
+            return false;
+    return true;
+}
+
+static
+Rows rows_of(const Flat::Tree& tree) {
+    return {
+        Flat::Ref(tree.size()), Flat::Ref(tree.stmts.size()),
+        Flat::Ref(tree.ints.size()), Flat::Ref(tree.floats.size()),
+        tree.types.data(), tree.ops.data(), tree.pos.data(), tree.data.data(),
+        tree.ints.data(), tree.floats.data(), tree.stmts.data(),
+        tree.source, tree.extra, false,
+    };
+}
+
+
+bool cache::write(const std::string& path, std::string_view source, uint32_t flags,
+                  const Flat::Tree& tree, const std::vector<Diagnostic>& diags, std::string& err) {
+    // Identifiers become spans: of the source where the name is spelled at
+    // the node's position, as it is unless the parser made the name up,
+    // and of extra otherwise.
+    std::vector<Flat::Data> data = tree.data;
+    std::string extra = tree.extra;
+    for (Flat::Ref i = 0; i < tree.size(); i++) {
+        if (tree.type(i) != EXPR_LIT_IDENT)
+            continue;
+        std::string_view name = SymbolTable::global().spelling(tree.symbol(i));
+        uint32_t pos = tree.pos[i];
+        if (source.substr(std::min<std::size_t>(pos, source.size()), name.size()) == name) {
+            data[i] = {pos, uint32_t(name.size())};
+        } else {
+            data[i] = {uint32_t(source.size() + extra.size()), uint32_t(name.size())};
+            extra += name;
+        }
+    }
+    if (source.size() + extra.size() > UINT32_MAX) {
+        err = "source too large";
+        return false;
+    }
+
+    Header h = {};
+    std::memcpy(h.magic, magic, sizeof magic);
+    h.version = format_version;
+    h.source_hash = hash(source);
+    h.source_size = source.size();
+    h.flags = flags;
+    h.nodes = tree.size();
+    h.ints = tree.ints.size();
+    h.floats = tree.floats.size();
+    h.stmts = tree.stmts.size();
+    h.extra = extra.size();
+    h.diags = diags.size();
+    std::vector<DiagRecord> records;
+    for (const Diagnostic& d : diags) {
+        records.push_back({uint32_t(d.pos.row), uint32_t(d.pos.col), uint32_t(d.msg.size())});
+        h.diag_bytes += d.msg.size();
+    }
+    Layout l = layout(h);
+
+    // The body is put together in memory first, for its hash.
+    Writer body;
+    auto put = [&](std::size_t at, const void* p, std::size_t n) {
+        body.put(std::string(at - sizeof(Header) - body.size(), '\0')); // padding up to the section
+        body.put(std::string_view(static_cast<const char*>(p), n));
+    };
+    put(l.ints, tree.ints.data(), tree.ints.size() * sizeof(int64_t));
+    put(l.floats, tree.floats.data(), tree.floats.size() * sizeof(double));
+    put(l.data, data.data(), data.size() * sizeof(Flat::Data));
+    put(l.pos, tree.pos.data(), tree.pos.size() * sizeof(uint32_t));
+    put(l.stmts, tree.stmts.data(), tree.stmts.size() * sizeof(Flat::Ref));
+    put(l.diags, records.data(), records.size() * sizeof(DiagRecord));
+    put(l.types, tree.types.data(), tree.types.size());
+    put(l.ops, tree.ops.data(), tree.ops.size());
+    put(l.extra, extra.data(), extra.size());
+    put(l.diag_text, "", 0);
+    for (const Diagnostic& d : diags)
+        body.put(d.msg);
+    put(l.size, "", 0);
+    h.entry_hash = hash(body.str());
+
+    // A name of its own, as threads compiling files with the same contents
+    // write the same entry at once.
+    std::string tmp = path + ".tmp.XXXXXX";
+    int fd = mkostemp(tmp.data(), O_CLOEXEC);
+    if (fd < 0) {
+        err = std::strerror(errno);
+        return false;
+    }
+    fchmod(fd, 0644);
+    {
+        Writer out(fd);
+        out.put(std::string_view(reinterpret_cast<const char*>(&h), sizeof h));
+        out.put(body.str());
+        out.flush();
+        err = out.error();
+    }
+    if (::close(fd) < 0 && err.empty())
+        err = std::strerror(errno);
+    if (err.empty() && std::rename(tmp.c_str(), path.c_str()) < 0)
+        err = std::strerror(errno);
+    if (!err.empty()) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+Program* cache::read(const std::string& path, std::string_view source, uint32_t flags,
+                     const ErrorHandler& report) {
+    Source entry;
+    std::string err;
+    if (!entry.open(path, err))
+        return nullptr;
+    std::string_view bytes = entry.text();
+    if (bytes.size() < sizeof(Header))
+        return nullptr;
+
+    Header h;
+    std::memcpy(&h, bytes.data(), sizeof h);
+    if (std::memcmp(h.magic, magic, sizeof magic) != 0 || h.version != format_version ||
+        h.flags != flags || h.source_size != source.size())
+        return nullptr;
+    Layout l = layout(h);
+    if (bytes.size() != l.size || h.source_hash != hash(source) ||
+        h.entry_hash != hash(bytes.substr(sizeof h)))
+        return nullptr;
+
+    // Sections start at multiples of 8 from the start of the mapping, or of
+    // the heap buffer the file was read into, so they can be used in place.
+    const char* base = bytes.data();
+    Rows r = {
+        h.nodes, h.stmts, h.ints, h.floats,
+        reinterpret_cast<const uint8_t*>(base + l.types),
+        reinterpret_cast<const uint8_t*>(base + l.ops),
+        reinterpret_cast<const uint32_t*>(base + l.pos),
+        reinterpret_cast<const Flat::Data*>(base + l.data),
+        reinterpret_cast<const int64_t*>(base + l.ints),
+        reinterpret_cast<const double*>(base + l.floats),
+        reinterpret_cast<const Flat::Ref*>(base + l.stmts),
+        source, bytes.substr(l.extra, h.extra), true,
+    };
+    const DiagRecord* records = reinterpret_cast<const DiagRecord*>(base + l.diags);
+    uint64_t diag_bytes = 0;
+    for (uint32_t i = 0; i < h.diags; i++)
+        diag_bytes += records[i].len;
+    if (diag_bytes != h.diag_bytes || !valid(r))
+        return nullptr;
+
+    Program* prog = build(r);
+    prog->shared = flags & SHARED;
+    std::string_view text = bytes.substr(l.diag_text, h.diag_bytes);
+    for (uint32_t i = 0; i < h.diags; i++) {
+        report({records[i].row, records[i].col}, std::string(text.substr(0, records[i].len)));
+        text.remove_prefix(records[i].len);
+    }
+    return prog;
+}
+
+
+cache::Cache::Cache(std::string dir) : m_dir(std::move(dir)) {
+    ::mkdir(m_dir.c_str(), 0777); // may well exist already
+}
+
+std::string cache::Cache::path(std::string_view source, uint32_t flags) const {
+    char name[40];
+    std::snprintf(name, sizeof name, "/%016llx-%x.ast",
+                  static_cast<unsigned long long>(hash(source)), unsigned(flags));
+    return m_dir + name;
+}
+
+Program* cache::Cache::parse(std::string_view source, uint32_t flags, const ErrorHandler& report,
+                             ThreadPool* lex_pool, bool* hit, stats::Stats* st) {
+    std::string entry = path(source, flags);
+    stats::Timer load(st, stats::PARSE, lex_pool != nullptr);
+    if (Program* prog = read(entry, source, flags, report)) {
+        if (hit)
+            *hit = true;
+        if (st)
+            st->uncounted++;
+        return prog;
+    }
+    load.stop();
+    if (hit)
+        *hit = false;
+
+    // Parse into the flat form, which is what an entry holds, and build
+    // the Program from it as a load would.
+    std::vector<Diagnostic> diags;
+    auto collect = [&](FilePos pos, std::string msg) {
+        report(pos, msg);
+        diags.push_back({pos, std::move(msg)});
+    };
+    if (source.size() > Flat::Builder::max_input) {
+        stats::Timer parse(st, stats::PARSE);
+        if (st)
+            st->uncounted++;
+        Parser parser(source, report);
+        parser.set_folding(flags & FOLDED);
+        parser.set_sharing(flags & SHARED);
+        return parser.parse_program();
+    }
+    stats::Timer lex(st, stats::LEX, lex_pool != nullptr);
+    Lexer lexer(source, collect);
+    TokenBuffer toks = lex_pool ? lexer.tokenize(*lex_pool) : lexer.tokenize();
+    lex.stop();
+    if (st)
+        st->count_tokens(toks);
+    stats::Timer parse(st, stats::PARSE);
+    FlatParser parser(std::move(toks), collect);
+    parser.set_folding(flags & FOLDED);
+    parser.set_sharing(flags & SHARED);
+    Flat::Tree tree = parser.parse_program();
+    std::string err;
+    write(entry, source, flags, tree, diags, err);
+    Program* prog = build(rows_of(tree));
+    prog->shared = flags & SHARED;
+    return prog;
+}
@@ -0,0 +1,78 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ast.hpp"
+#include "flat_ast.hpp"
+
+class ThreadPool;
+namespace stats { struct Stats; }
+
+// A directory of parsed trees, keyed by a hash of the source text, so that
+// files which haven't changed since the last run need no lexing or parsing.
+//
+// An entry is a Flat::Tree written out as its arrays, plus the diagnostics
+// the parse gave. Everything in it is an index or an offset, into the
+// entry or into the source, so it is loaded by mapping the file and
+// building the Program in one pass over the rows. Identifiers are stored
+// as spans and interned again on loading, since Symbols differ from run to
+// run. An entry whose magic, version, source size or hash doesn't match,
+// whose own hash is off, or whose rows don't check out, is ignored and
+// rewritten.
+//
+// Entries hold their numbers in the byte order of the machine that wrote
+// them; one from a machine of the other order fails the version check.
+namespace cache {
+
+    // Bump whenever the layout or the meaning of an entry changes, and
+    // whenever the parser starts building different trees.
+    inline constexpr uint32_t format_version = 2;
+
+    // A fast non-cryptographic 64-bit hash, the same on every run.
+    uint64_t hash(std::string_view data, uint64_t seed = 0);
+
+    struct Diagnostic {
+        AST::FilePos pos;
+        std::string msg;
+    };
+
+    // How a tree was parsed; trees parsed differently have their own entries.
+    enum Flags : uint32_t {
+        FOLDED = 1, // BasicParser::set_folding
+        SHARED = 2, // BasicParser::set_sharing
+    };
+
+    // Writes `tree`, the parse of `source`, to `path`, through a temporary
+    // file so that a reader never sees half an entry.
+    bool write(const std::string& path, std::string_view source, uint32_t flags,
+               const AST::Flat::Tree& tree, const std::vector<Diagnostic>& diags, std::string& err);
+    // The tree stored at `path` for `source`, with its diagnostics passed
+    // to `report`, or nullptr if there is no valid entry for it. String
+    // literals refer into `source`, as they do after parsing.
+    AST::Program* read(const std::string& path, std::string_view source, uint32_t flags,
+                       const AST::ErrorHandler& report);
+
+    class Cache {
+        std::string m_dir;
+    public:
+        // The directory is created if it doesn't exist.
+        explicit Cache(std::string dir);
+
+        // The entry of `source` parsed as `flags` say.
+        std::string path(std::string_view source, uint32_t flags) const;
+
+        // Parser(source).parse_program() with the options in `flags`,
+        // diagnostics included, from the cache when possible; otherwise the
+        // source is parsed and an entry written. Writing is best effort: a
+        // cache that can't be written to only makes every call a miss.
+        // `hit`, if given, tells which. With `st` the phases are timed, and
+        // the tokens counted when the source is lexed.
+        AST::Program* parse(std::string_view source, uint32_t flags, const AST::ErrorHandler& report,
+                            ThreadPool* lex_pool = nullptr, bool* hit = nullptr, stats::Stats* st = nullptr);
+    };
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "codegen.hpp"
+#include "visitor.hpp"
+#include <charconv>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+using namespace AST;
+
+
+// The names a tree uses, in order of first use.
+template <class Access>
+class CollectNames : public Walker<CollectNames<Access>, Access> {
+    std::vector<bool> seen; // by Symbol, which are small and dense enough
+public:
+    using Handle = typename Access::Handle;
+    std::vector<Symbol> names;
+
+    explicit CollectNames(Access access) : Walker<CollectNames<Access>, Access>(access) {}
+
+    bool pre(Handle n) {
+        if (this->access.type(n) != EXPR_LIT_IDENT)
+            return true;
+        Symbol sym = this->access.symbol(n);
+        if (sym >= seen.size())
+            seen.resize(std::max<std::size_t>(sym + 1, seen.size() * 2));
+        if (!seen[sym]) {
+            seen[sym] = true;
+            names.push_back(sym);
+        }
+        return false;
+    }
+};
+
+// Every operator is parenthesized, so C precedence never comes into it;
+// the operator spellings of Panda are those of C.
+template <class Access>
+class EmitC : public Walker<EmitC<Access>, Access> {
+    Writer& out;
+
+    // Negative values are parenthesized so that a unary minus before
+    // them can't run into a "--".
+    void int_lit(int64_t v) {
+        if (v == INT64_MIN) {
+            out.put("(-9223372036854775807LL - 1)");
+        } else {
+            if (v < 0)
+                out.put('(');
+            out.put_int(v);
+            out.put(v < 0 ? "LL)" : "LL");
+        }
+    }
+
+    void float_lit(double v) {
+        if (std::isnan(v)) {
+            out.put("NAN");
+        } else if (std::isinf(v)) {
+            out.put(v < 0 ? "(-HUGE_VAL)" : "HUGE_VAL");
+        } else {
+            char tmp[32];
+            std::string_view s(tmp, std::to_chars(tmp, tmp + sizeof tmp, v).ptr - tmp);
+            if (v < 0)
+                out.put('(');
+            out.put(s);
+            // "1e+20" and "0.5" are doubles already, "3" is not.
+            if (s.find_first_of(".e") == s.npos)
+                out.put(".0");
+            if (v < 0)
+                out.put(')');
+        }
+    }
+public:
+    using Handle = typename Access::Handle;
+
+    EmitC(Writer& out, Access access) : Walker<EmitC<Access>, Access>(access), out(out) {}
+
+    bool pre(Handle n) {
+        const Access& a = this->access;
+        switch (a.type(n)) {
+            case EXPR_LIT_IDENT:
+                out.put("pd_");
+                out.put(a.spelling(n));
+                return false;
+            case EXPR_LIT_STRING:
+                // Panda escapes are spelled like C's.
+                out.put('"');
+                out.put(a.spelling(n));
+                out.put('"');
+                return false;
+            case EXPR_LIT_INT:
+                int_lit(a.int_value(n));
+                return false;
+            case EXPR_LIT_FLOAT:
+                float_lit(a.float_value(n));
+                return false;
+            case EXPR_BAD:
+                out.put('0');
+                return false;
+            case EXPR_UNARY:
+                out.put('(');
+                out.put(token_spelling(a.op(n)));
+                return true;
+            case EXPR_BINARY:
+                out.put('(');
+                return true;
+            case STMT_EXPR:
+                out.put("    (void)");
+                return true;
+            default:
+                return true;
+        }
+    }
+
+    void between(Handle n, std::size_t) {
+        if (this->access.type(n) == EXPR_BINARY) {
+            out.put(' ');
+            out.put(token_spelling(this->access.op(n)));
+            out.put(' ');
+        }
+    }
+
+    void post(Handle n) {
+        switch (this->access.type(n)) {
+            case EXPR_UNARY:
+            case EXPR_BINARY:
+                out.put(')');
+                break;
+            case STMT_EXPR:
+                out.put(";\n");
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+static
+void prologue(const std::vector<Symbol>& names, Writer& out) {
+    out.put("#include <math.h>\n"
+            "#include <stdint.h>\n"
+            "\n");
+    for (Symbol sym : names) {
+        out.put("static int64_t pd_");
+        out.put(SymbolTable::global().spelling(sym));
+        out.put(";\n");
+    }
+    if (!names.empty())
+        out.put('\n');
+    out.put("int main(void) {\n");
+}
+
+static
+void epilogue(Writer& out) {
+    out.put("    return 0;\n"
+            "}\n");
+}
+
+void codegen::emit_c(Program* prog, Writer& out) {
+    CollectNames<PointerAccess> names{PointerAccess()};
+    names.walk(prog);
+    prologue(names.names, out);
+    EmitC<PointerAccess>(out, PointerAccess()).walk(prog);
+    epilogue(out);
+}
+
+void codegen::emit_c(const Flat::Tree& tree, Writer& out) {
+    CollectNames<FlatAccess> names{FlatAccess(tree)};
+    for (Flat::Ref stmt : tree.stmts)
+        names.walk(stmt);
+    prologue(names.names, out);
+    EmitC<FlatAccess> emit(out, FlatAccess(tree));
+    for (Flat::Ref stmt : tree.stmts)
+        emit.walk(stmt);
+    epilogue(out);
+}
@@ -0,0 +1,18 @@
+#ifndef CODEGEN_HPP
+#define CODEGEN_HPP
+
+#include "ast.hpp"
+#include "flat_ast.hpp"
+#include "writer.hpp"
+
+// Translates a tree to a C translation unit. Statements become the body of
+// main(); every Panda name `x` is declared as the C global `pd_x`, which
+// keeps it clear of C keywords and library names. The tree should be free
+// of errors: an EXPR_BAD becomes a 0.
+namespace codegen {
+
+    void emit_c(AST::Program* prog, Writer& out);
+    void emit_c(const AST::Flat::Tree& tree, Writer& out);
+}
+
+#endif
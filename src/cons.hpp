@@ -0,0 +1,95 @@
+#ifndef CONS_HPP
+#define CONS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Hash-consing: a table of the distinct nodes of a tree, so that a builder
+// can hand out one node for every occurrence of the same subtree. Nodes
+// are made first and looked up after; the builder takes a new node back
+// when the table already has an equal one. Children are compared by
+// identity, which is enough because they went through the table first.
+//
+// `Handle` is whatever refers to a node, `Hash` and `Equal` give a node's
+// structural hash and compare two nodes.
+template <class Handle, class Hash, class Equal>
+class ConsTable {
+    struct Slot {
+        uint64_t hash;
+        Handle node;
+        bool used;
+    };
+
+    std::vector<Slot> slots;
+    std::size_t count = 0;
+    Hash hash;
+    Equal equal;
+
+    void grow() {
+        std::vector<Slot> old(slots.empty() ? 1024 : slots.size() * 2);
+        old.swap(slots);
+        for (const Slot& s : old)
+            if (s.used)
+                place(s);
+    }
+
+    void place(const Slot& s) {
+        std::size_t mask = slots.size() - 1;
+        std::size_t i = s.hash & mask;
+        while (slots[i].used)
+            i = (i + 1) & mask;
+        slots[i] = s;
+    }
+public:
+    explicit ConsTable(Hash hash = Hash(), Equal equal = Equal())
+    : hash(std::move(hash)), equal(std::move(equal)) {}
+
+    // The node equal to `n` that came first, after putting `n` in the
+    // table if it is the first. When `found` is set the caller can
+    // take `n` back.
+    Handle intern(Handle n, bool& found) {
+        if (count * 4 >= slots.size() * 3) // keep the load under 3/4
+            grow();
+        uint64_t h = hash(n);
+        std::size_t mask = slots.size() - 1;
+        for (std::size_t i = h & mask; slots[i].used; i = (i + 1) & mask) {
+            if (slots[i].hash == h && equal(slots[i].node, n)) {
+                found = true;
+                return slots[i].node;
+            }
+        }
+        place({h, n, true});
+        count++;
+        found = false;
+        return n;
+    }
+
+    std::size_t size() const { return count; }
+};
+
+// Helpers for the Hash functions of the trees.
+namespace cons {
+
+    inline uint64_t mix(uint64_t h, uint64_t v) {
+        h ^= v + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+        h *= 0xBF58476D1CE4E5B9ull;
+        return h ^ (h >> 31);
+    }
+
+    inline uint64_t bits(double d) {
+        uint64_t v;
+        std::memcpy(&v, &d, sizeof v);
+        return v;
+    }
+
+    // FNV-1a; string literals are short.
+    inline uint64_t bytes(const char* p, std::size_t n) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (std::size_t i = 0; i < n; i++)
+            h = (h ^ uint8_t(p[i])) * 0x100000001b3ull;
+        return h;
+    }
+}
+
+#endif
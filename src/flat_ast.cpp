@@ -0,0 +1,157 @@
+#include "flat_ast.hpp"
+#include <utility>
+
+using namespace AST::Flat;
+
+
+std::string_view Tree::spelling(Ref n) const {
+    if (type(n) == EXPR_LIT_IDENT)
+        return SymbolTable::global().spelling(symbol(n));
+    std::size_t offs = data[n].lhs;
+    std::size_t len = data[n].rhs;
+    if (offs >= source.size())
+        return std::string_view(extra).substr(offs - source.size(), len);
+    return source.substr(offs, len);
+}
+
+uint64_t Tree::shallow_hash(Ref n) const {
+    uint64_t h = cons::mix(0, types[n]);
+    switch (type(n)) {
+        case EXPR_LIT_STRING: {
+            std::string_view s = spelling(n);
+            return cons::mix(h, cons::bytes(s.data(), s.size()));
+        }
+        case EXPR_LIT_INT:   return cons::mix(h, int_value(n));
+        case EXPR_LIT_FLOAT: return cons::mix(h, cons::bits(float_value(n)));
+        default:
+            return cons::mix(cons::mix(cons::mix(h, ops[n]), data[n].lhs), data[n].rhs);
+    }
+}
+
+bool Tree::shallow_equal(Ref a, Ref b) const {
+    if (types[a] != types[b])
+        return false;
+    switch (type(a)) {
+        case EXPR_LIT_STRING: return spelling(a) == spelling(b);
+        case EXPR_LIT_INT:    return int_value(a) == int_value(b);
+        case EXPR_LIT_FLOAT:  return cons::bits(float_value(a)) == cons::bits(float_value(b));
+        default:
+            return ops[a] == ops[b] && data[a].lhs == data[b].lhs && data[a].rhs == data[b].rhs;
+    }
+}
+
+std::size_t Tree::memory_usage() const {
+    return types.capacity() * sizeof(uint8_t) +
+        ops.capacity() * sizeof(uint8_t) +
+        pos.capacity() * sizeof(uint32_t) +
+        data.capacity() * sizeof(Data) +
+        ints.capacity() * sizeof(int64_t) +
+        floats.capacity() * sizeof(double) +
+        stmts.capacity() * sizeof(Ref) +
+        extra.capacity();
+}
+
+
+Ref Builder::add(NodeType type, std::size_t pos, uint32_t lhs, uint32_t rhs, Token op) {
+    Ref n = tree.types.size();
+    tree.types.push_back(type);
+    tree.ops.push_back(uint8_t(op));
+    tree.pos.push_back(pos);
+    tree.data.push_back({lhs, rhs});
+    return n;
+}
+
+Data Builder::span(std::string_view s) {
+    const char* src = tree.source.data();
+    if (s.data() >= src && s.data() + s.size() <= src + tree.source.size())
+        return {uint32_t(s.data() - src), uint32_t(s.size())};
+    uint32_t offs = tree.source.size() + tree.extra.size();
+    tree.extra += s;
+    return {offs, uint32_t(s.size())};
+}
+
+void Builder::begin(std::string_view input) {
+    tree = Tree();
+    tree.source = input;
+    table.reset(m_share ? new ConsTable<Ref, Hash, Equal>(Hash{&tree}, Equal{&tree}) : nullptr);
+}
+
+Ref Builder::share(Ref n) {
+    if (!table)
+        return n;
+    bool found;
+    Ref c = table->intern(n, found);
+    if (found)
+        drop(n);
+    return c;
+}
+
+Builder::Expr Builder::ident(std::size_t pos, std::string_view name) {
+    return share(add(EXPR_LIT_IDENT, pos, SymbolTable::global().intern(name), 0));
+}
+
+Builder::Expr Builder::string(std::size_t pos, std::string_view value) {
+    Data d = span(value);
+    return share(add(EXPR_LIT_STRING, pos, d.lhs, d.rhs));
+}
+
+Builder::Expr Builder::int_lit(std::size_t pos, int64_t value) {
+    tree.ints.push_back(value);
+    return share(add(EXPR_LIT_INT, pos, tree.ints.size() - 1, 0));
+}
+
+Builder::Expr Builder::float_lit(std::size_t pos, double value) {
+    tree.floats.push_back(value);
+    return share(add(EXPR_LIT_FLOAT, pos, tree.floats.size() - 1, 0));
+}
+
+Builder::Expr Builder::bad(std::size_t pos) {
+    return add(EXPR_BAD, pos, none, none); // one for each error, as in TreeBuilder
+}
+
+Builder::Expr Builder::unary(std::size_t pos, Token op, Expr right) {
+    return share(add(EXPR_UNARY, pos, none, right, op));
+}
+
+Builder::Expr Builder::binary(std::size_t pos, Expr left, Token op, Expr right) {
+    return share(add(EXPR_BINARY, pos, left, right, op));
+}
+
+bool Builder::constant(Expr e, fold::Const& c) {
+    switch (tree.type(e)) {
+        case EXPR_LIT_INT: c = fold::Const::of_int(tree.int_value(e)); return true;
+        case EXPR_LIT_FLOAT: c = fold::Const::of_float(tree.float_value(e)); return true;
+        default: return false;
+    }
+}
+
+// Folding replaces literals just after making them, so they are usually
+// the last rows and can be taken back off the arrays. Shared ones stay,
+// as the table still refers to them.
+void Builder::discard(Expr e) {
+    if (!table)
+        drop(e);
+}
+
+void Builder::drop(Ref e) {
+    if (e + 1 != tree.size())
+        return;
+    if (tree.type(e) == EXPR_LIT_INT && tree.lhs(e) + 1 == tree.ints.size())
+        tree.ints.pop_back();
+    if (tree.type(e) == EXPR_LIT_FLOAT && tree.lhs(e) + 1 == tree.floats.size())
+        tree.floats.pop_back();
+    tree.types.pop_back();
+    tree.ops.pop_back();
+    tree.pos.pop_back();
+    tree.data.pop_back();
+}
+
+Builder::Stmt Builder::stmt_expr(std::size_t pos, Expr expr) {
+    return add(STMT_EXPR, pos, expr, none);
+}
+
+Builder::Result Builder::finish(std::vector<Stmt> stmts) {
+    tree.stmts = std::move(stmts);
+    table.reset();
+    return std::move(tree);
+}
@@ -0,0 +1,119 @@
+#ifndef FLAT_AST_HPP
+#define FLAT_AST_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ast.hpp"
+#include "cons.hpp"
+
+// A compact alternative to the pointer-based tree in ast.hpp. Nodes are rows
+// in a handful of parallel arrays and refer to their children by 32-bit
+// index, so a node costs 14 bytes and a whole tree is a few contiguous
+// allocations. Source offsets are 32-bit, which limits inputs to 4 GiB.
+namespace AST::Flat {
+
+    using Ref = uint32_t;
+    inline constexpr Ref none = UINT32_MAX;
+
+    // What a node's two data words hold depends on its type:
+    //   EXPR_LIT_IDENT    Symbol, -
+    //   EXPR_LIT_STRING   offset and length of the spelling
+    //   EXPR_LIT_INT      index into ints
+    //   EXPR_LIT_FLOAT    index into floats
+    //   EXPR_UNARY        -, operand
+    //   EXPR_BINARY       left operand, right operand
+    //   EXPR_BAD          -, -
+    //   STMT_EXPR         expression, -
+    struct Data {
+        uint32_t lhs;
+        uint32_t rhs;
+    };
+
+    struct Tree {
+        std::vector<uint8_t> types; // NodeType
+        std::vector<uint8_t> ops;   // Token, for unary and binary expressions
+        std::vector<uint32_t> pos;  // source offset
+        std::vector<Data> data;
+
+        std::vector<int64_t> ints;
+        std::vector<double> floats;
+        std::vector<Ref> stmts;     // top-level statements, in order
+
+        // String spellings are spans of the source. Offsets past its end
+        // refer into `extra`, which holds the few spellings the parser makes
+        // up. Identifiers are interned in SymbolTable::global() instead.
+        std::string_view source;
+        std::string extra;
+
+        std::size_t size() const { return types.size(); }
+        NodeType type(Ref n) const { return NodeType(types[n]); }
+        Token op(Ref n) const { return Token(ops[n]); }
+        Ref lhs(Ref n) const { return data[n].lhs; }
+        Ref rhs(Ref n) const { return data[n].rhs; }
+
+        // Of an identifier or string.
+        std::string_view spelling(Ref n) const;
+        Symbol symbol(Ref n) const { return data[n].lhs; }
+        int64_t int_value(Ref n) const { return ints[data[n].lhs]; }
+        double float_value(Ref n) const { return floats[data[n].lhs]; }
+
+        // Same output as Program::string() for the equivalent tree;
+        // defined with Printer in printer.cpp.
+        std::string string() const;
+        // Bytes held by the arrays.
+        std::size_t memory_usage() const;
+
+        // As AST::shallow_hash and AST::shallow_equal, for rows.
+        uint64_t shallow_hash(Ref n) const;
+        bool shallow_equal(Ref a, Ref b) const;
+    };
+
+    // Builds a Tree on behalf of BasicParser; see TreeBuilder in ast.hpp.
+    class Builder {
+        struct Hash {
+            const Tree* tree;
+            uint64_t operator()(Ref n) const { return tree->shallow_hash(n); }
+        };
+        struct Equal {
+            const Tree* tree;
+            bool operator()(Ref a, Ref b) const { return tree->shallow_equal(a, b); }
+        };
+
+        Tree tree;
+        bool m_share = false;
+        std::unique_ptr<ConsTable<Ref, Hash, Equal>> table; // while sharing
+
+        Ref add(NodeType type, std::size_t pos, uint32_t lhs, uint32_t rhs, Token op = Token::UNKNOWN);
+        Data span(std::string_view s);
+        // Takes the last row off again.
+        void drop(Ref n);
+        // The first row equal to the new row `n`, which is dropped if it
+        // is not the first.
+        Ref share(Ref n);
+    public:
+        using Expr = Ref;
+        using Stmt = Ref;
+        using Result = Tree;
+        static constexpr std::size_t max_input = UINT32_MAX;
+
+        // See AST::TreeBuilder::set_sharing.
+        void set_sharing(bool on) { m_share = on; }
+        void begin(std::string_view input);
+        Expr ident(std::size_t pos, std::string_view name);
+        Expr string(std::size_t pos, std::string_view value);
+        Expr int_lit(std::size_t pos, int64_t value);
+        Expr float_lit(std::size_t pos, double value);
+        Expr bad(std::size_t pos);
+        Expr unary(std::size_t pos, Token op, Expr right);
+        Expr binary(std::size_t pos, Expr left, Token op, Expr right);
+        bool constant(Expr e, fold::Const& c);
+        void discard(Expr e);
+        Stmt stmt_expr(std::size_t pos, Expr expr);
+        Result finish(std::vector<Stmt> stmts);
+    };
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "fold.hpp"
+
+using fold::Const;
+using fold::Status;
+
+
+static inline
+double as_float(Const c) {
+    return c.kind == Const::INT ? double(c.i) : c.f;
+}
+
+static inline
+bool truthy(Const c) {
+    return c.kind == Const::INT ? c.i != 0 : c.f != 0;
+}
+
+template <class T>
+static inline
+Const compare(Token op, T l, T r) {
+    switch (op) {
+        case Token::EQUAL:     return Const::of_int(l == r);
+        case Token::NOTEQ:     return Const::of_int(l != r);
+        case Token::LESS:      return Const::of_int(l < r);
+        case Token::GREATER:   return Const::of_int(l > r);
+        case Token::LESSEQ:    return Const::of_int(l <= r);
+        default:               return Const::of_int(l >= r);
+    }
+}
+
+Status fold::unary(Token op, Const x, Const& out) {
+    switch (op) {
+        case Token::ADD:
+            out = x;
+            return Status::OK;
+        case Token::SUB:
+            if (x.kind == Const::FLOAT) {
+                out = Const::of_float(-x.f);
+                return Status::OK;
+            }
+            if (x.i == INT64_MIN)
+                return Status::OVERFLOW;
+            out = Const::of_int(-x.i);
+            return Status::OK;
+        case Token::NOT:
+            out = Const::of_int(!truthy(x));
+            return Status::OK;
+        default:
+            return Status::UNSUPPORTED;
+    }
+}
+
+Status fold::binary(Token op, Const l, Const r, Const& out) {
+    switch (op) {
+        case Token::AND:
+            out = Const::of_int(truthy(l) && truthy(r));
+            return Status::OK;
+        case Token::OR:
+            out = Const::of_int(truthy(l) || truthy(r));
+            return Status::OK;
+        case Token::EQUAL:
+        case Token::NOTEQ:
+        case Token::LESS:
+        case Token::GREATER:
+        case Token::LESSEQ:
+        case Token::GREATEREQ:
+            out = l.kind == Const::INT && r.kind == Const::INT
+                ? compare(op, l.i, r.i)
+                : compare(op, as_float(l), as_float(r));
+            return Status::OK;
+        case Token::ADD:
+        case Token::SUB:
+        case Token::MUL:
+        case Token::DIV:
+            break;
+        default:
+            return Status::UNSUPPORTED;
+    }
+
+    if (l.kind == Const::FLOAT || r.kind == Const::FLOAT) {
+        double a = as_float(l), b = as_float(r);
+        switch (op) {
+            case Token::ADD: out = Const::of_float(a + b); break;
+            case Token::SUB: out = Const::of_float(a - b); break;
+            case Token::MUL: out = Const::of_float(a * b); break;
+            default:
+                if (b == 0)
+                    return Status::DIV_BY_ZERO;
+                out = Const::of_float(a / b);
+                break;
+        }
+        return Status::OK;
+    }
+
+    int64_t a = l.i, b = r.i, v;
+    switch (op) {
+        case Token::ADD:
+            if (__builtin_add_overflow(a, b, &v))
+                return Status::OVERFLOW;
+            break;
+        case Token::SUB:
+            if (__builtin_sub_overflow(a, b, &v))
+                return Status::OVERFLOW;
+            break;
+        case Token::MUL:
+            if (__builtin_mul_overflow(a, b, &v))
+                return Status::OVERFLOW;
+            break;
+        default:
+            if (b == 0)
+                return Status::DIV_BY_ZERO;
+            if (a == INT64_MIN && b == -1)
+                return Status::OVERFLOW;
+            v = a / b;
+            break;
+    }
+    out = Const::of_int(v);
+    return Status::OK;
+}
+
+const char* fold::message(Status s) {
+    switch (s) {
+        case Status::DIV_BY_ZERO: return "division by zero in constant expression";
+        case Status::OVERFLOW:    return "integer overflow in constant expression";
+        default:                  return "";
+    }
+}
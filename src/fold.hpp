@@ -0,0 +1,39 @@
+#ifndef FOLD_HPP
+#define FOLD_HPP
+
+#include <cstdint>
+#include "token.hpp"
+
+// Evaluation of operators on literal operands, for constant folding.
+// Semantics follow C, which Panda compiles to: int64 arithmetic that must
+// not overflow, IEEE double arithmetic, an int operand is converted to
+// double when the other one is a double, and comparisons and logical
+// operators give the int 0 or 1.
+namespace fold {
+
+    struct Const {
+        enum Kind { INT, FLOAT } kind;
+        union {
+            int64_t i;
+            double f;
+        };
+
+        static Const of_int(int64_t v) { Const c; c.kind = INT; c.i = v; return c; }
+        static Const of_float(double v) { Const c; c.kind = FLOAT; c.f = v; return c; }
+    };
+
+    enum class Status {
+        OK,
+        UNSUPPORTED,    // not an operator that folds; leave the node alone
+        DIV_BY_ZERO,
+        OVERFLOW,
+    };
+
+    Status unary(Token op, Const x, Const& out);
+    Status binary(Token op, Const l, Const r, Const& out);
+
+    // The diagnostic for a Status other than OK and UNSUPPORTED.
+    const char* message(Status s);
+}
+
+#endif
@@ -0,0 +1,151 @@
+#include "incremental.hpp"
+#include "parser.hpp"
+#include <algorithm>
+
+// Whether a run of tokens ends with a newline, so that another chunk
+// could start after it. The last token is ENDMARKER; a newline before it
+// must be a real one at the very end, not a ';'.
+static
+bool ends_cleanly(const TokenBuffer& toks) {
+    std::size_t n = toks.size();
+    return n >= 2 && toks.toks[n - 2].type == Token::NEWLINE &&
+           toks.toks[n - 2].offset + 1 == toks.input.size() && toks.input.back() == '\n';
+}
+
+struct Document::Chunk {
+    std::string text;
+    TokenBuffer toks;
+    std::unique_ptr<AST::Program> tree;
+    std::vector<Diagnostic> diags; // rows relative to the chunk
+    std::size_t newlines = 0;
+
+    // The chunk is never moved once made, so toks and tree can refer
+    // into text.
+    explicit Chunk(std::string_view s) : text(s) {
+        auto report = [this](AST::FilePos pos, std::string msg) {
+            diags.push_back({pos, std::move(msg)});
+        };
+        toks = Lexer(text, report).tokenize();
+        tree.reset(Parser(toks, report).parse_program());
+        // Lexer errors all come first; put them in with the parser's.
+        std::stable_sort(diags.begin(), diags.end(), [](const Diagnostic& a, const Diagnostic& b) {
+            return a.pos.row != b.pos.row ? a.pos.row < b.pos.row : a.pos.col < b.pos.col;
+        });
+        newlines = std::count(text.begin(), text.end(), '\n');
+    }
+};
+
+Document::Document(std::string_view text, std::size_t chunk_size)
+: chunk_size(std::max<std::size_t>(chunk_size, 1)) {
+    m_chunks = build(Lexer(text, [](AST::FilePos, std::string) {}).tokenize());
+    total = 0;
+    for (const auto& c : m_chunks) {
+        starts.push_back(total);
+        total += c->text.size();
+    }
+    reparsed = text.size();
+}
+
+Document::~Document() = default;
+
+// Splits the text of `toks` into chunks, cutting after a newline once a
+// chunk has reached chunk_size.
+std::vector<std::unique_ptr<Document::Chunk>> Document::build(const TokenBuffer& toks) const {
+    std::vector<std::unique_ptr<Chunk>> out;
+    std::string_view text = toks.input;
+    std::size_t begin = 0;
+    for (const PackedTok& t : toks.toks) {
+        if (t.type == Token::NEWLINE && text[t.offset] == '\n' && t.offset + 1 - begin >= chunk_size) {
+            out.push_back(std::make_unique<Chunk>(text.substr(begin, t.offset + 1 - begin)));
+            begin = t.offset + 1;
+        }
+    }
+    if (begin < text.size() || out.empty())
+        out.push_back(std::make_unique<Chunk>(text.substr(begin)));
+    return out;
+}
+
+void Document::apply(Edit edit) {
+    edit.offset = std::min(edit.offset, total);
+    edit.removed = std::min(edit.removed, total - edit.offset);
+
+    // The chunks the edit touches: from the one holding its first byte to
+    // the one holding its last, or the first one again for an insertion.
+    auto chunk_at = [&](std::size_t offs) {
+        std::size_t i = std::upper_bound(starts.begin(), starts.end(), offs) - starts.begin();
+        return i ? i - 1 : 0;
+    };
+    std::size_t first = chunk_at(edit.offset);
+    std::size_t last = edit.removed ? chunk_at(edit.offset + edit.removed - 1) : first;
+
+    std::string text;
+    for (std::size_t i = first; i <= last; i++)
+        text += m_chunks[i]->text;
+    text.replace(edit.offset - starts[first], edit.removed, edit.inserted);
+
+    // Take in following chunks until the new text ends where a chunk may
+    // end, after a newline the lexer took as one: a string can go on past
+    // a newline escaped with '\', and then the chunks after it have to be
+    // lexed again whatever they looked like on their own. One much smaller
+    // than chunk_size is merged with the next too, so that edits don't
+    // leave the document in splinters. While the text doesn't end cleanly
+    // it is at least doubled before it is lexed again, so that all the
+    // lexing adds up to about twice its final size.
+    std::size_t end = last + 1;
+    TokenBuffer toks;
+    for (;;) {
+        toks = Lexer(text, [](AST::FilePos, std::string) {}).tokenize();
+        bool clean = ends_cleanly(toks);
+        if (end == m_chunks.size() || (clean && text.size() >= chunk_size / 2))
+            break;
+        std::size_t goal = clean ? 0 : 2 * text.size();
+        do
+            text += m_chunks[end++]->text;
+        while (end < m_chunks.size() && text.size() < goal);
+    }
+
+    std::vector<std::unique_ptr<Chunk>> fresh = build(toks);
+    reparsed = text.size();
+    m_chunks.erase(m_chunks.begin() + first, m_chunks.begin() + end);
+    m_chunks.insert(m_chunks.begin() + first,
+                    std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+
+    total = total - edit.removed + edit.inserted.size();
+    starts.resize(m_chunks.size());
+    std::size_t offs = starts[first];
+    for (std::size_t i = first; i < m_chunks.size(); i++) {
+        starts[i] = offs;
+        offs += m_chunks[i]->text.size();
+    }
+}
+
+std::string Document::text() const {
+    std::string s;
+    s.reserve(total);
+    for (const auto& c : m_chunks)
+        s += c->text;
+    return s;
+}
+
+std::string_view Document::chunk_text(std::size_t i) const {
+    return m_chunks[i]->text;
+}
+
+const TokenBuffer& Document::chunk_tokens(std::size_t i) const {
+    return m_chunks[i]->toks;
+}
+
+AST::Program* Document::chunk_tree(std::size_t i) const {
+    return m_chunks[i]->tree.get();
+}
+
+std::vector<Document::Diagnostic> Document::diagnostics() const {
+    std::vector<Diagnostic> out;
+    std::size_t row = 0; // lines before the chunk
+    for (const auto& c : m_chunks) {
+        for (const Diagnostic& d : c->diags)
+            out.push_back({{d.pos.row + row, d.pos.col}, d.msg});
+        row += c->newlines;
+    }
+    return out;
+}
@@ -0,0 +1,76 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "lexer.hpp"
+#include "ast.hpp"
+
+// A source text that is edited in place and keeps its tokens and trees up
+// to date without redoing the whole file.
+//
+// The text is held in chunks of about chunk_size bytes, each lexed and
+// parsed on its own. A chunk begins after a newline that a lex of the
+// whole text takes as a NEWLINE token, not one escaped inside a string:
+// the Lexer holds no state there, and no statement spans a newline, so
+// these are safe places to restart lexing and parsing, and a chunk's
+// tokens and tree are the same as that part of a whole-file parse. An
+// edit re-lexes and re-parses the chunks it touches, and the ones after
+// them until the tokens are back in step, which is at the end of the
+// last of them unless the edit opened a string that goes on past a
+// newline. The work per edit is therefore bounded by chunk_size plus the
+// size of the edit, apart from some bookkeeping per chunk and from such
+// strings.
+//
+// Each chunk's tokens and tree hold offsets relative to the chunk.
+class Document {
+public:
+    struct Edit {
+        std::size_t offset;
+        std::size_t removed;
+        std::string_view inserted;
+    };
+
+    struct Diagnostic {
+        AST::FilePos pos;
+        std::string msg;
+    };
+
+    explicit Document(std::string_view text, std::size_t chunk_size = 16 * 1024);
+    ~Document();
+    Document(const Document&) = delete;
+    Document& operator=(const Document&) = delete;
+
+    // Offsets past the end are clamped to it.
+    void apply(Edit edit);
+
+    std::size_t size() const { return total; }
+    std::string text() const;
+
+    std::size_t chunks() const { return m_chunks.size(); }
+    std::size_t chunk_offset(std::size_t i) const { return starts[i]; }
+    std::string_view chunk_text(std::size_t i) const;
+    const TokenBuffer& chunk_tokens(std::size_t i) const;
+    AST::Program* chunk_tree(std::size_t i) const;
+
+    // The diagnostics of every chunk with positions in the whole text,
+    // ordered by position.
+    std::vector<Diagnostic> diagnostics() const;
+
+    // Bytes lexed and parsed again by the last apply().
+    std::size_t last_reparsed() const { return reparsed; }
+private:
+    struct Chunk;
+
+    std::size_t chunk_size;
+    std::vector<std::unique_ptr<Chunk>> m_chunks;
+    std::vector<std::size_t> starts; // offset of each chunk
+    std::size_t total = 0;
+    std::size_t reparsed = 0;
+
+    std::vector<std::unique_ptr<Chunk>> build(const TokenBuffer& toks) const;
+};
+
+#endif
@@ -2,6 +2,12 @@
 
 #include <memory>
 #include <map>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include "thread_pool.hpp"
+#include "number.hpp"
 
 
 static inline
@@ -37,25 +43,84 @@ int digit_value(char c) {
     return 16; // larger than any legal digit
 }
 
-static
-Token lookup_keyword(const std::string& ident) {
-    if (ident == "let")         return Token::LET;
-    if (ident == "if")          return Token::IF;
-    if (ident == "else")        return Token::ELSE;
-    if (ident == "true")        return Token::TRUE;
-    if (ident == "false")       return Token::FALSE;
-    if (ident == "fun")         return Token::FUN;
-    if (ident == "for")         return Token::FOR;
-    if (ident == "while")       return Token::WHILE;
-    if (ident == "break")       return Token::BREAK;
-    if (ident == "continue")    return Token::CONTINUE;
-    if (ident == "in")          return Token::IN;
+/*
+ * Keywords are recognized with a perfect hash over (first char, last char,
+ * length), searched for at compile time from keyword_spelling.
+ */
 
+static constexpr
+uint32_t keyword_hash(std::string_view s, uint32_t seed, unsigned bits) {
+    uint32_t key = uint32_t(uint8_t(s.front())) << 16 |
+                   uint32_t(uint8_t(s.back())) << 8 |
+                   uint32_t(uint8_t(s.size()));
+    return ((key ^ seed) * 0x9E3779B1u) >> (32 - bits);
+}
+
+struct KeywordSlot {
+    std::string_view spelling; // empty if the slot is unused
+    Token tok = Token::IDENT;
+};
+
+struct KeywordTable {
+    static constexpr unsigned max_bits = 8;
+    uint32_t seed = 0;
+    unsigned bits = 0;
+    KeywordSlot slots[1 << max_bits] {};
+};
+
+static consteval
+bool keyword_hash_is_perfect(uint32_t seed, unsigned bits) {
+    bool used[1 << KeywordTable::max_bits] {};
+    for (std::string_view kw : keyword_spelling) {
+        uint32_t h = keyword_hash(kw, seed, bits);
+        if (used[h]) return false;
+        used[h] = true;
+    }
+    return true;
+}
+
+static consteval
+KeywordTable build_keyword_table() {
+    for (unsigned bits = 1; bits <= KeywordTable::max_bits; bits++) {
+        if ((std::size_t(1) << bits) < std::size(keyword_spelling))
+            continue;
+        for (uint32_t seed = 0; seed < 4096; seed++) {
+            if (!keyword_hash_is_perfect(seed, bits))
+                continue;
+            KeywordTable t;
+            t.seed = seed;
+            t.bits = bits;
+            for (std::size_t i = 0; i < std::size(keyword_spelling); i++)
+                t.slots[keyword_hash(keyword_spelling[i], seed, bits)] = {keyword_spelling[i], keyword_token(i)};
+            return t;
+        }
+    }
+    throw "no perfect hash for the keywords, extend the key or KeywordTable::max_bits";
+}
+
+static constexpr KeywordTable keywords = build_keyword_table();
+
+static inline
+Token lookup_keyword(std::string_view ident) {
+    const KeywordSlot& slot = keywords.slots[keyword_hash(ident, keywords.seed, keywords.bits)];
+    if (slot.spelling.size() == ident.size() &&
+        std::memcmp(slot.spelling.data(), ident.data(), ident.size()) == 0)
+        return slot.tok;
     return Token::IDENT;
 }
 
 void Lexer::error(std::size_t offs, std::string msg) {
-    error_handler(AST::FilePos_from_offset(offs, input), "Lexer Error: " + msg);
+    if (raw_errors) {
+        raw_errors->push_back({offs, std::move(msg), raw_tok});
+        return;
+    }
+    error_handler(file_pos(offs), "Lexer Error: " + msg);
+}
+
+AST::FilePos Lexer::file_pos(std::size_t offs) {
+    if (!lines)
+        lines = std::make_unique<AST::LineTable>(input);
+    return lines->pos(offs);
 }
 
 void Lexer::read() {    
@@ -65,13 +130,20 @@ void Lexer::read() {
         return;
     }
     ch = input[offset];
+}
 
-    if (ch == '\n') {
-        row += 1;
-        col = 1;
-    } else {
-        col += 1;
-    }
+void Lexer::seek(std::size_t offs) {
+    offset = offs;
+    ch = offset < input.size() ? input[offset] : 0;
+}
+
+void Lexer::skip(scan::Scanner scanner) {
+    if (offset >= input.size())
+        return;
+    const char* p = input.data() + offset;
+    std::size_t n = scanner(p, input.data() + input.size()) - p;
+    offset += n;
+    ch = offset < input.size() ? input[offset] : 0;
 }
 
 char Lexer::peek() {
@@ -83,11 +155,20 @@ char Lexer::peek() {
 }
 
 void Lexer::skip_whitespace() {
-    while (is_space(ch)) read();
+    // Most runs are a single space, don't bother the scanner with those.
+    if (!is_space(ch)) return;
+    read();
+    skip(scan::space);
 }
 
 void Lexer::read_digits(int base) {
+    bool after_digit = false, reported = false;
     while (ch == '_' || digit_value(ch) < base) {
+        if (ch == '_' && !reported && (!after_digit || digit_value(peek()) >= base)) {
+            error(offset, "'_' must separate digits");
+            reported = true;
+        }
+        after_digit = ch != '_';
         read();
     }
 }
@@ -114,33 +195,33 @@ bool Lexer::read_escape() {
     }
 }
 
-std::string Lexer::read_string() {
+std::string_view Lexer::read_string() {
     std::size_t offs = offset; // already skipped the '"'
     for (;;) {
+        skip(scan::string);
         char _ch = ch;
-        if (ch == '\n' || ch == 0) {
+        if (ch == '\n' || offset >= input.size()) {
                 error(offset, "string literal not terminated");
-                break;
+                return input.substr(offs, offset - offs); // no '"' to leave out
         }
         read();
         if (_ch == '"') break;
         if (_ch == '\\') read_escape();
+        else if (_ch == 0) error(offset - 1, "unexpected NUL byte");
     }
-    return std::string(input.substr(offs, offset - offs - 1));
+    return input.substr(offs, offset - offs - 1);
     // -1 in order to not include the last '"'
 }
 
-std::string Lexer::read_ident() {
+std::string_view Lexer::read_ident() {
     std::size_t offs = offset;
 
-    while (is_identifier_part(ch)) {
-        read();
-    }
-    return std::string(input.substr(offs, offset-offs));
+    skip(scan::ident);
+    return input.substr(offs, offset-offs);
 }
 
 LexTok Lexer::read_number() {
-    int offs = offset;
+    std::size_t offs = offset;
     LexTok ret;
     ret.type = Token::INT; // Assuming it is an int
     int base = 10; // assumed base is 10
@@ -162,7 +243,9 @@ LexTok Lexer::read_number() {
     }
 
     // read entire number
+    std::size_t digits = offset;
     read_digits(base);
+    std::size_t digits_end = offset;
 
     // fractional part
     if (ch == '.' && (base == 10 || base == 16)) {
@@ -178,19 +261,36 @@ LexTok Lexer::read_number() {
         if (ch == '-' || ch == '+') {
             read();
         }
-        int offs = offset;
+        std::size_t exp_offs = offset;
         read_digits(10);
-        if (offs == offset) {
+        if (exp_offs == offset) {
             error(offset, "exponent has no digits");
         }
     }
     ret.literal = input.substr(offs, offset-offs);
+
+    // Work out the value while the literal is still in cache.
+    number::Status st;
+    if (ret.type == Token::INT) {
+        st = number::to_int(input.substr(digits, digits_end - digits), base, ret.value.i);
+        if (st == number::Status::INVALID)
+            error(offs, "invalid integer");
+        else if (st == number::Status::OUT_OF_RANGE)
+            error(offs, "integer out of range");
+    } else {
+        st = number::to_float(ret.literal, ret.value.f);
+        if (st == number::Status::INVALID)
+            error(offs, "invalid float");
+        else if (st == number::Status::OUT_OF_RANGE)
+            error(offs, "float out of range");
+    }
     return ret;
 }
 
 LexTok Lexer::nextToken() {
     skip_whitespace();
     char _ch = ch;
+    std::size_t pos = offset;
     LexTok ret; 
 
     if (is_identifier_start(ch)) {
@@ -202,6 +302,7 @@ LexTok Lexer::nextToken() {
         goto read_operators;
     }
     
+    ret.pos = pos;
     return ret;
 
 
@@ -211,7 +312,13 @@ read_operators:
 
     switch (_ch) {
         case 0:
-            ret.type = Token::ENDMARKER;
+            if (pos < input.size()) { // a NUL byte in the text, not its end
+                error(pos, "unexpected NUL byte");
+                ret.type = Token::UNKNOWN;
+                ret.literal = input.substr(pos, 1);
+            } else {
+                ret.type = Token::ENDMARKER;
+            }
             break;
         case '\n':
             while(ch == '\n') read(); // skip all the newlines
@@ -232,7 +339,7 @@ read_operators:
         case '/':
         {
             if (ch == '/') {
-                while (ch != '\n') read();
+                skip(scan::line);
                 return nextToken();
             }
             else
@@ -271,9 +378,8 @@ read_operators:
             break;
         case '&':
             if (ch != '&') {
-                std::cout << ch << std::endl;
                 ret.type = Token::UNKNOWN;
-                ret.literal = _ch;
+                ret.literal = input.substr(offset - 1, 1);
             } else {
                 read();
                 ret.type = Token::AND;
@@ -282,7 +388,7 @@ read_operators:
         case '|':
             if (ch != '|') {
                 ret.type = Token::UNKNOWN;
-                ret.literal = _ch;
+                ret.literal = input.substr(offset - 1, 1);
             } else {
                 read();
                 ret.type = Token::OR;
@@ -331,7 +437,206 @@ read_operators:
         break;
         default:
             ret.type = Token::UNKNOWN;
-            ret.literal = _ch;
+            ret.literal = input.substr(offset - 1, 1);
     }
+    ret.pos = pos;
     return ret;
-}
\ No newline at end of file
+}
+
+static inline
+PackedTok pack(const LexTok& t, std::vector<TokenBuffer::Number>& numbers) {
+    uint32_t length = t.literal.size();
+    if (t.type == Token::INT || t.type == Token::FLOAT) {
+        numbers.push_back({t.value, length});
+        length = numbers.size() - 1;
+    }
+    return {uint32_t(t.pos), length, t.type};
+}
+
+TokenBuffer Lexer::tokenize() {
+    TokenBuffer buf;
+    buf.input = input;
+    buf.toks.reserve(input.size() / 4 + 1); // a fair guess for most sources
+    for (;;) {
+        LexTok t = nextToken();
+        buf.toks.push_back(pack(t, buf.numbers));
+        if (t.type == Token::ENDMARKER)
+            return buf;
+    }
+}
+
+TokenBuffer Lexer::tokenize(ThreadPool& pool, std::size_t min_chunk) {
+    // Split after a run of newlines: that is a token boundary unless the
+    // newline is escaped inside a string literal.
+    std::size_t target = std::max(min_chunk, input.size() / (pool.size() * 4));
+    std::vector<std::size_t> starts {0};
+    for (std::size_t b = target; b < input.size(); b = starts.back() + target) {
+        const void* nl = std::memchr(input.data() + b, '\n', input.size() - b);
+        if (!nl)
+            break;
+        std::size_t s = static_cast<const char*>(nl) - input.data() + 1;
+        while (s < input.size() && input[s] == '\n')
+            s++;
+        if (s >= input.size())
+            break;
+        starts.push_back(s);
+    }
+    if (starts.size() == 1 || pool.size() == 1)
+        return tokenize();
+
+    struct Chunk {
+        std::size_t begin, end;     // owns the tokens starting in [begin, end)
+        std::vector<PackedTok> toks;
+        std::vector<TokenBuffer::Number> numbers;
+        std::vector<RawError> errors;
+        std::size_t stop = 0;       // offset just past the last token
+        std::size_t next_pos = 0;   // start of the first token past `end`
+        bool eof = false;           // the chunk ends with ENDMARKER
+    };
+    std::vector<Chunk> chunks(starts.size());
+    for (std::size_t k = 0; k < chunks.size(); k++) {
+        chunks[k].begin = starts[k];
+        chunks[k].end = k + 1 < starts.size() ? starts[k + 1] : SIZE_MAX;
+    }
+
+    pool.run(chunks.size(), [&](std::size_t k) {
+        Chunk& c = chunks[k];
+        Lexer lex(input, nullptr);
+        lex.raw_errors = &c.errors;
+        lex.seek(c.begin);
+        c.toks.reserve((std::min(c.end, input.size()) - c.begin) / 4 + 1);
+        for (;;) {
+            lex.raw_tok = c.toks.size();
+            LexTok t = lex.nextToken();
+            if (t.pos >= c.end) {
+                c.next_pos = t.pos;
+                break;
+            }
+            c.toks.push_back(pack(t, c.numbers));
+            c.stop = lex.offset;
+            if (t.type == Token::ENDMARKER) {
+                c.eof = true;
+                break;
+            }
+        }
+        // errors of the token that belongs to the next chunk
+        while (!c.errors.empty() && c.errors.back().tok >= c.toks.size())
+            c.errors.pop_back();
+    });
+
+    // Stitch the chunks together in order. Errors are reported as their
+    // tokens are accepted, so they come out in the same order as they would
+    // from tokenize().
+    struct Segment {
+        const std::vector<PackedTok>* toks;
+        const std::vector<TokenBuffer::Number>* numbers;
+        std::size_t begin, end;
+        std::size_t first_number = 0, n_numbers = 0; // in *numbers
+    };
+    struct Fixup {
+        std::vector<PackedTok> toks;
+        std::vector<TokenBuffer::Number> numbers;
+    };
+    std::vector<Segment> segments;
+    std::deque<Fixup> fixups;
+
+    auto adopt = [&](Chunk& c, std::size_t from) {
+        segments.push_back({&c.toks, &c.numbers, from, c.toks.size()});
+        for (RawError& e : c.errors)
+            if (e.tok >= from)
+                error(e.offs, std::move(e.msg));
+    };
+
+    adopt(chunks[0], 0);
+    std::size_t cursor = chunks[0].stop;
+    std::size_t next_pos = chunks[0].next_pos;
+    bool done = chunks[0].eof;
+
+    std::size_t k = 1;
+    while (!done && k < chunks.size()) {
+        Chunk& c = chunks[k];
+        if (!c.toks.empty() && c.toks.front().offset == next_pos) {
+            // The guess was right: the previous chunk's next token is this
+            // chunk's first one.
+            adopt(c, 0);
+            cursor = c.stop;
+            next_pos = c.next_pos;
+            done = c.eof;
+            k++;
+            continue;
+        }
+
+        // A token ran across the split. Lex on from the last accepted token
+        // until a token starts where one of the later chunks has one too;
+        // the lexer keeps no state between tokens, so from there on that
+        // chunk's tokens are the right ones.
+        Fixup& out = fixups.emplace_back();
+        std::vector<RawError> errs;
+        Lexer lex(input, nullptr);
+        lex.raw_errors = &errs;
+        lex.seek(cursor);
+        for (;;) {
+            errs.clear();
+            LexTok t = lex.nextToken();
+            while (k < chunks.size() && t.pos >= chunks[k].end)
+                k++;
+            if (k < chunks.size()) {
+                Chunk& d = chunks[k];
+                auto it = std::lower_bound(d.toks.begin(), d.toks.end(), t.pos,
+                    [](const PackedTok& p, std::size_t pos) { return p.offset < pos; });
+                if (it != d.toks.end() && it->offset == t.pos) {
+                    segments.push_back({&out.toks, &out.numbers, 0, out.toks.size()});
+                    adopt(d, it - d.toks.begin());
+                    cursor = d.stop;
+                    next_pos = d.next_pos;
+                    done = d.eof;
+                    k++;
+                    break;
+                }
+            }
+            for (RawError& e : errs)
+                error(e.offs, std::move(e.msg));
+            out.toks.push_back(pack(t, out.numbers));
+            if (t.type == Token::ENDMARKER) {
+                segments.push_back({&out.toks, &out.numbers, 0, out.toks.size()});
+                done = true;
+                break;
+            }
+        }
+    }
+
+    // Copy the pieces into place in parallel as well. The numbers of a
+    // segment's tokens are a run of its piece's, which moves as a whole.
+    pool.run(segments.size(), [&](std::size_t i) {
+        Segment& seg = segments[i];
+        for (std::size_t t = seg.begin; t < seg.end; t++) {
+            const PackedTok& p = (*seg.toks)[t];
+            if (p.type == Token::INT || p.type == Token::FLOAT) {
+                if (seg.n_numbers++ == 0)
+                    seg.first_number = p.length;
+            }
+        }
+    });
+    std::vector<std::size_t> at(segments.size() + 1, 0), num_at(segments.size() + 1, 0);
+    for (std::size_t i = 0; i < segments.size(); i++) {
+        at[i + 1] = at[i] + segments[i].end - segments[i].begin;
+        num_at[i + 1] = num_at[i] + segments[i].n_numbers;
+    }
+
+    TokenBuffer buf;
+    buf.input = input;
+    buf.toks.resize(at.back());
+    buf.numbers.resize(num_at.back());
+    pool.run(segments.size(), [&](std::size_t i) {
+        const Segment& seg = segments[i];
+        auto out = std::copy(seg.toks->begin() + seg.begin, seg.toks->begin() + seg.end,
+                             buf.toks.begin() + at[i]);
+        auto first = seg.numbers->begin() + seg.first_number;
+        std::copy(first, first + seg.n_numbers, buf.numbers.begin() + num_at[i]);
+        for (auto p = buf.toks.begin() + at[i]; p != out; ++p)
+            if (p->type == Token::INT || p->type == Token::FLOAT)
+                p->length = p->length - seg.first_number + num_at[i];
+    });
+    seek(buf.toks.back().offset);
+    return buf;
+}
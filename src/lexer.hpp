@@ -2,35 +2,108 @@
 #define LEXER_HPP
 
 #include <iostream>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <cstdint>
 #include "token.hpp"
 #include "ast.hpp"
+#include "scan.hpp"
 
+// The value of an INT or FLOAT token, worked out by the Lexer.
+union LitValue {
+    int64_t i; // INT
+    double f;  // FLOAT
+};
+
+// A token returned by the Lexer. The literal is a view into the Lexer's
+// input buffer, so producing a token never allocates; it stays valid for
+// as long as that buffer does.
 struct LexTok {
     Token type;
-    std::string literal;
+    std::string_view literal;
+    std::size_t pos = 0; // offset of the token's first byte
+    LitValue value = {0};
 
     friend bool operator==(LexTok &l, Token tok) { return l.type == tok; }
     friend bool operator!=(LexTok &l, Token tok) { return l.type != tok; }
-    friend bool operator==(LexTok &l, std::string literal) { return l.literal == literal; }
-    friend bool operator!=(LexTok &l, std::string literal) { return l.literal != literal; }
+    friend bool operator==(LexTok &l, std::string_view literal) { return l.literal == literal; }
+    friend bool operator!=(LexTok &l, std::string_view literal) { return l.literal != literal; }
+};
+
+// A token in a TokenBuffer: 12 bytes and no pointers. `offset` is where the
+// token starts and `length` is the length of its literal, which begins at
+// `offset`, except for STRING where it begins after the opening quote.
+// INT and FLOAT tokens have no room for their value, so their `length` is
+// an index into TokenBuffer::numbers, which holds it with the length.
+struct PackedTok {
+    uint32_t offset;
+    uint32_t length;
+    Token type;
 };
 
+// The whole token stream of an input, produced by Lexer::tokenize().
+// The last token is always ENDMARKER.
+struct TokenBuffer {
+    struct Number {
+        LitValue value;
+        uint32_t length;
+    };
+
+    std::string_view input;
+    std::vector<PackedTok> toks;
+    std::vector<Number> numbers; // of INT and FLOAT tokens, in order
+
+    // Offsets are 32-bit, so larger inputs have to be lexed on the fly.
+    static constexpr std::size_t max_input = UINT32_MAX;
+
+    std::size_t size() const { return toks.size(); }
+    LexTok get(std::size_t i) const {
+        const PackedTok& t = toks[i];
+        if (t.type == Token::INT || t.type == Token::FLOAT) {
+            const Number& n = numbers[t.length];
+            return {t.type, input.substr(t.offset, n.length), t.offset, n.value};
+        }
+        std::size_t offs = t.offset + (t.type == Token::STRING);
+        return {t.type, t.length ? input.substr(offs, t.length) : std::string_view(), t.offset};
+    }
+};
+
+class ThreadPool;
+
 class Lexer {
     std::string_view input;
     char ch = 0;
     std::size_t offset = 0;
-    int row = 1, col = 1; // pos in the input
-    void (*error_handler)(AST::FilePos, std::string);
+    std::unique_ptr<AST::LineTable> lines; // built on the first error
+    AST::ErrorHandler error_handler;
+
+    // Lexers working on one chunk of a parallel tokenize() don't report
+    // errors, they keep them here together with the index of the token
+    // being lexed, so errors of tokens that get thrown away can be dropped.
+    struct RawError {
+        std::size_t offs;
+        std::string msg;
+        std::size_t tok;
+    };
+    std::vector<RawError>* raw_errors = nullptr;
+    std::size_t raw_tok = 0;
+
+    // Continue lexing at `offs`.
+    void seek(std::size_t offs);
     
     // Advance to the next byte
     void read();
+    // Advance past the run of bytes recognized by `scanner`.
+    void skip(scan::Scanner scanner);
     // Peek the next char, after the curent one and return it. Without advancing.
     char peek();
     void skip_whitespace();
     void skip_comment();
+    // Reads digits in `base` and '_' separators between them.
     void read_digits(int base);
-    std::string read_string();
-    std::string read_ident();
+    std::string_view read_string();
+    std::string_view read_ident();
 
     // converts an offset to the position in rows and columns
     // then passes them to the error_handler, together with the std::string
@@ -41,11 +114,28 @@ class Lexer {
 public:
     std::string_view get_input() { return input; }
     std::size_t get_pos() { return offset; };
-    explicit Lexer(const std::string& s, void(*error_handler)(AST::FilePos, std::string)) 
-    : input(s),  error_handler(error_handler) {
+    // Converts an offset in the input to a row and column.
+    AST::FilePos file_pos(std::size_t offs);
+    // The input needs no terminating NUL, nothing past its end is ever read,
+    // so it can be a read-only mapping of a file. A NUL byte inside the
+    // input is an error, lexed as an UNKNOWN token; only the end of the
+    // input gives ENDMARKER.
+    explicit Lexer(std::string_view s, AST::ErrorHandler error_handler) 
+    : input(s),  error_handler(std::move(error_handler)) {
         if (input.size() > 0)
             ch = input[0]; // initialize the first char
     }
     LexTok nextToken();
+    // Lex everything up to and including ENDMARKER in one go.
+    // The input must not be larger than TokenBuffer::max_input.
+    TokenBuffer tokenize();
+    // Same result as tokenize(), errors included, but the input is split
+    // into chunks at line breaks that are lexed on the pool's threads.
+    // Each chunk is lexed on the guess that it starts at a token boundary;
+    // where a token such as a string literal runs across a split, the
+    // stitching pass re-lexes from the end of the previous chunk until it
+    // meets a token the next chunk also found. Inputs smaller than two
+    // chunks of `min_chunk` bytes are lexed on the calling thread.
+    TokenBuffer tokenize(ThreadPool& pool, std::size_t min_chunk = 1 << 20);
 };
 #endif
@@ -1,7 +1,306 @@
 #include <iostream>
-#include <fstream>
-#include "./lexer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "./parser.hpp"
+#include "./printer.hpp"
+#include "./codegen.hpp"
+#include "./vm.hpp"
+#include "./source.hpp"
+#include "./cache.hpp"
+#include "./stats.hpp"
+#include "./thread_pool.hpp"
 
-int main() {
-    // Will work!
+struct Diagnostic {
+    AST::FilePos pos;
+    std::string msg;
+};
+
+// One input file and everything produced for it. Each unit is only touched
+// by the worker that compiles it; main() reads the results after the pool
+// has finished, in command line order.
+struct Unit {
+    std::string path;
+    std::size_t size = 0;
+    std::string io_error;
+    std::vector<Diagnostic> diags;
+    std::string ast; // with --ast
+    std::string run_result; // with --run
+    std::string run_error;
+    stats::Stats stats; // with --stats or --trace
+};
+
+struct Options {
+    bool dump_ast = false;
+    AST::PrintFormat ast_format = AST::PrintFormat::HUMAN;
+    bool fold = false;
+    bool share = false; // pays off only on repetitive sources
+    bool emit_c = false; // to <file>.c, or the standard output for "-"
+    bool run = false;
+    std::string cache_dir; // keep parsed trees here between runs
+    enum { NO_STATS, STATS_TABLE, STATS_JSON } stats = NO_STATS;
+    std::string stats_path; // the JSON; the table goes to the standard error
+    std::string trace_path; // Chrome trace events of every phase of every file
+    unsigned jobs = 0; // 0: one per hardware thread
+    std::vector<std::string> files;
+};
+
+static
+void usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [--ast[=compact]] [--fold] [--share] [--emit-c] [--run] [--cache DIR]\n"
+              << "       [--stats | --stats=json FILE] [--trace FILE] [-j N] file...\n"
+              << "--share saves memory on repetitive sources, such as generated code; on others it\n"
+              << "costs time and memory.\n";
+}
+
+static
+bool parse_args(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--ast") == 0) {
+            opts.dump_ast = true;
+        } else if (std::strcmp(argv[i], "--ast=compact") == 0) {
+            opts.dump_ast = true;
+            opts.ast_format = AST::PrintFormat::COMPACT;
+        } else if (std::strcmp(argv[i], "--fold") == 0) {
+            opts.fold = true;
+        } else if (std::strcmp(argv[i], "--share") == 0) {
+            opts.share = true;
+        } else if (std::strcmp(argv[i], "--emit-c") == 0) {
+            opts.emit_c = true;
+        } else if (std::strcmp(argv[i], "--run") == 0) {
+            opts.run = true;
+        } else if (std::strcmp(argv[i], "--cache") == 0) {
+            if (++i == argc)
+                return false;
+            opts.cache_dir = argv[i];
+        } else if (std::strcmp(argv[i], "--stats") == 0) {
+            opts.stats = Options::STATS_TABLE;
+        } else if (std::strcmp(argv[i], "--stats=json") == 0) {
+            if (++i == argc)
+                return false;
+            opts.stats = Options::STATS_JSON;
+            opts.stats_path = argv[i];
+        } else if (std::strcmp(argv[i], "--trace") == 0) {
+            if (++i == argc)
+                return false;
+            opts.trace_path = argv[i];
+        } else if (std::strcmp(argv[i], "-j") == 0 || std::strcmp(argv[i], "--jobs") == 0) {
+            if (++i == argc)
+                return false;
+            opts.jobs = std::stoul(argv[i]);
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            return false;
+        } else {
+            // "-" is the standard input
+            opts.files.push_back(std::strcmp(argv[i], "-") == 0 ? "/dev/stdin" : argv[i]);
+        }
+    }
+    return !opts.files.empty();
+}
+
+// Files at least this large are lexed in parallel when there is only one.
+static constexpr std::size_t parallel_lex_size = 64 << 20;
+
+static
+void write_c(Unit& unit, AST::Program* prog) {
+    bool to_stdout = unit.path == "/dev/stdin";
+    std::string path = unit.path + ".c";
+    int fd = to_stdout ? 1 : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        unit.io_error = "cannot write " + path + ": " + std::strerror(errno);
+        return;
+    }
+    Writer out(fd);
+    codegen::emit_c(prog, out);
+    out.flush();
+    if (!out.error().empty())
+        unit.io_error = "cannot write " + path + ": " + out.error();
+    if (!to_stdout)
+        ::close(fd);
+}
+
+// For --stats=json and --trace.
+static
+bool write_file(const std::string& path, std::string_view text) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        std::cerr << "cannot write " << path << ": " << std::strerror(errno) << '\n';
+        return false;
+    }
+    Writer out(fd);
+    out.put(text);
+    out.flush();
+    ::close(fd);
+    if (!out.error().empty()) {
+        std::cerr << "cannot write " << path << ": " << out.error() << '\n';
+        return false;
+    }
+    return true;
+}
+
+static
+void compile(Unit& unit, const Options& opts, cache::Cache* cache, ThreadPool* lex_pool) {
+    stats::Stats* st = nullptr;
+    double start = 0;
+    if (opts.stats != Options::NO_STATS || !opts.trace_path.empty()) {
+        st = &unit.stats;
+        st->tracing = !opts.trace_path.empty();
+        st->file = unit.path;
+        start = stats::now();
+    }
+
+    Source src;
+    stats::Timer read(st, stats::READ);
+    if (!src.open(unit.path, unit.io_error))
+        return;
+    read.stop();
+    if (st)
+        st->bytes += src.text().size();
+
+    auto report = [&unit](AST::FilePos pos, std::string msg) {
+        unit.diags.push_back({pos, std::move(msg)});
+    };
+    AST::Program* prog;
+    if (cache) {
+        uint32_t flags = (opts.fold ? uint32_t(cache::FOLDED) : 0) | (opts.share ? uint32_t(cache::SHARED) : 0);
+        prog = cache->parse(src.text(), flags, report, lex_pool, nullptr, st);
+    } else if (src.text().size() <= TokenBuffer::max_input) {
+        // What ParseMode::BUFFERED does, with the lexing on its own.
+        stats::Timer lex(st, stats::LEX, lex_pool != nullptr);
+        Lexer lexer(src.text(), report);
+        TokenBuffer toks = lex_pool ? lexer.tokenize(*lex_pool) : lexer.tokenize();
+        lex.stop();
+        if (st)
+            st->count_tokens(toks);
+        stats::Timer parse(st, stats::PARSE);
+        Parser parser(std::move(toks), report);
+        parser.set_folding(opts.fold);
+        parser.set_sharing(opts.share);
+        prog = parser.parse_program();
+    } else {
+        stats::Timer parse(st, stats::PARSE);
+        if (st)
+            st->uncounted++;
+        Parser parser(src.text(), report);
+        parser.set_folding(opts.fold);
+        parser.set_sharing(opts.share);
+        prog = parser.parse_program();
+    }
+    if (st)
+        st->count_nodes(prog);
+    if (opts.dump_ast) {
+        stats::Timer print(st, stats::PRINT);
+        AST::Printer printer(opts.ast_format);
+        printer.print(prog);
+        unit.ast = printer.take();
+    }
+    if (opts.emit_c && unit.diags.empty()) {
+        stats::Timer emit(st, stats::EMIT);
+        write_c(unit, prog);
+    }
+    if (opts.run && unit.diags.empty()) {
+        stats::Timer run(st, stats::RUN);
+        vm::Chunk chunk;
+        vm::Machine machine;
+        vm::Value result;
+        if (vm::compile(prog, chunk, unit.run_error) && machine.run(chunk, result, unit.run_error))
+            unit.run_result = vm::to_string(result);
+    }
+    delete prog;
+    if (st)
+        stats::file_span(st, start);
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    try {
+        if (!parse_args(argc, argv, opts)) {
+            usage(argv[0]);
+            return 2;
+        }
+    } catch (const std::exception&) { // bad number for -j
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<Unit> units(opts.files.size());
+    for (std::size_t i = 0; i < units.size(); i++) {
+        units[i].path = opts.files[i];
+        struct stat st;
+        if (stat(units[i].path.c_str(), &st) == 0)
+            units[i].size = st.st_size;
+    }
+
+    // Hand out the largest files first so that no big file is left to run
+    // alone at the end.
+    std::vector<std::size_t> order(units.size());
+    for (std::size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return units[a].size > units[b].size;
+    });
+
+    std::unique_ptr<cache::Cache> cache;
+    if (!opts.cache_dir.empty())
+        cache = std::make_unique<cache::Cache>(opts.cache_dir);
+
+    // Running out of memory fails the file, not the others.
+    auto compile_unit = [&](Unit& unit, ThreadPool* lex_pool) {
+        try {
+            compile(unit, opts, cache.get(), lex_pool);
+        } catch (const std::bad_alloc&) {
+            unit.io_error = "out of memory";
+        }
+    };
+    if (units.size() == 1 && units[0].size >= parallel_lex_size) {
+        // Nothing to spread across files, spread the lexing instead.
+        ThreadPool pool(opts.jobs);
+        compile_unit(units[0], &pool);
+    } else {
+        unsigned jobs = std::min<std::size_t>(opts.jobs ? opts.jobs : std::thread::hardware_concurrency(),
+                                              units.size());
+        ThreadPool pool(jobs);
+        pool.run(order.size(), [&](std::size_t i) { compile_unit(units[order[i]], nullptr); });
+    }
+
+    stats::Stats total;
+    stats::Timer report(opts.stats != Options::NO_STATS || !opts.trace_path.empty() ? &total : nullptr,
+                        stats::REPORT);
+    int errors = 0;
+    for (const Unit& unit : units) {
+        if (!unit.io_error.empty()) {
+            std::cerr << unit.path << ": " << unit.io_error << '\n';
+            errors++;
+        }
+        for (const Diagnostic& d : unit.diags)
+            std::cerr << unit.path << ':' << d.pos.row << ':' << d.pos.col << ": " << d.msg << '\n';
+        errors += unit.diags.size();
+        if (!unit.run_error.empty()) {
+            std::cerr << unit.path << ": " << unit.run_error << '\n';
+            errors++;
+        }
+        std::cout << unit.ast;
+        if (!unit.run_result.empty())
+            std::cout << unit.run_result << '\n';
+    }
+    std::cout.flush();
+    report.stop();
+
+    for (const Unit& unit : units)
+        total.add(unit.stats);
+    if (opts.stats == Options::STATS_TABLE)
+        std::cerr << stats::table(total, stats::now());
+    else if (opts.stats == Options::STATS_JSON && !write_file(opts.stats_path, stats::json(total, stats::now())))
+        errors++;
+    if (!opts.trace_path.empty() && !write_file(opts.trace_path, stats::trace(total.spans)))
+        errors++;
+
+    return errors ? 1 : 0;
 }
@@ -0,0 +1,168 @@
+#include "number.hpp"
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using number::Status;
+
+
+static inline
+int digit_value(char c) {
+    if ('0' <= c && c <= '9')
+        return (c - '0');
+    else if ('a' <= c && c <= 'f')
+        return (c - 'a' + 10);
+    else if ('A' <= c && c <= 'F')
+        return (c - 'A' + 10);
+    return 16; // larger than any legal digit
+}
+
+static inline
+bool has_separator(std::string_view s) {
+    return std::memchr(s.data(), '_', s.size()) != nullptr;
+}
+
+// Accumulates v * base + d, or returns false once it leaves uint64_t.
+static inline
+bool push_digit(uint64_t& v, unsigned base, unsigned d) {
+    return !__builtin_mul_overflow(v, base, &v) && !__builtin_add_overflow(v, d, &v);
+}
+
+static
+Status finish_int(uint64_t v, bool overflow, int64_t& out) {
+    if (overflow || v > uint64_t(INT64_MAX)) {
+        out = INT64_MAX;
+        return Status::OUT_OF_RANGE;
+    }
+    out = int64_t(v);
+    return Status::OK;
+}
+
+// Any base, with separators.
+static
+Status int_scalar(std::string_view digits, unsigned base, int64_t& out) {
+    uint64_t v = 0;
+    bool any = false, overflow = false;
+    for (char c : digits) {
+        if (c == '_')
+            continue;
+        unsigned d = digit_value(c);
+        if (d >= base)
+            return Status::INVALID;
+        overflow |= !push_digit(v, base, d);
+        any = true;
+    }
+    if (!any)
+        return Status::INVALID;
+    return finish_int(v, overflow, out);
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NUMBER_SWAR 1
+
+/*
+ * SWAR: eight ASCII digits loaded as one little-endian word, first digit
+ * in the low byte, are checked and combined with a few multiplications
+ * instead of eight dependent multiply-adds.
+ */
+
+static inline
+uint64_t load8(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+static inline
+bool is_eight_digits(uint64_t v) {
+    // Every byte is 0x30..0x39: its high nibble is 3, and adding 6 keeps it 3.
+    return ((v & 0xF0F0F0F0F0F0F0F0) |
+            (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+}
+
+static inline
+uint32_t eight_digits_value(uint64_t v) {
+    v -= 0x3030303030303030;
+    v = v * 10 + (v >> 8);  // pairs of digits, in every other byte
+    v = (((v & 0x000000FF000000FF) * (100 + (1000000ull << 32))) +
+         (((v >> 16) & 0x000000FF000000FF) * (1 + (10000ull << 32)))) >> 32;
+    return uint32_t(v);
+}
+#endif
+
+static
+Status int_decimal(std::string_view digits, int64_t& out) {
+    const char* p = digits.data();
+    const char* end = p + digits.size();
+    uint64_t v = 0;
+    bool overflow = false;
+#ifdef NUMBER_SWAR
+    while (end - p >= 8) {
+        uint64_t w = load8(p);
+        if (!is_eight_digits(w))
+            return Status::INVALID;
+        overflow |= __builtin_mul_overflow(v, 100000000u, &v) ||
+                    __builtin_add_overflow(v, eight_digits_value(w), &v);
+        p += 8;
+    }
+#endif
+    for (; p < end; p++) {
+        unsigned d = unsigned(*p) - '0';
+        if (d > 9)
+            return Status::INVALID;
+        overflow |= !push_digit(v, 10, d);
+    }
+    return finish_int(v, overflow, out);
+}
+
+Status number::to_int(std::string_view digits, int base, int64_t& out) {
+    out = 0;
+    if (digits.empty())
+        return Status::INVALID;
+    if (has_separator(digits))
+        return int_scalar(digits, base, out);
+    if (base == 10)
+        return int_decimal(digits, out);
+
+    uint64_t v = 0;
+    auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), v, base);
+    if (ptr != digits.data() + digits.size() && ec != std::errc::result_out_of_range)
+        return Status::INVALID;
+    return finish_int(v, ec == std::errc::result_out_of_range, out);
+}
+
+Status number::to_float(std::string_view text, double& out) {
+    out = 0;
+    // Drop the separators; a literal without any, the usual case, is used
+    // in place.
+    std::string plain;
+    if (has_separator(text)) {
+        plain.reserve(text.size());
+        for (char c : text)
+            if (c != '_')
+                plain += c;
+        text = plain;
+    }
+
+    std::chars_format fmt = std::chars_format::general;
+    std::string_view body = text;
+    if (text.size() >= 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        fmt = std::chars_format::hex;
+        body.remove_prefix(2);
+    }
+    if (body.empty() || body[0] == '+' || body[0] == '-')
+        return Status::INVALID;
+
+    auto [ptr, ec] = std::from_chars(body.data(), body.data() + body.size(), out, fmt);
+    if (ptr != body.data() + body.size())
+        return Status::INVALID;
+    if (ec == std::errc::result_out_of_range) {
+        // from_chars leaves `out` alone then; strtod gives HUGE_VAL, or the
+        // nearest subnormal or zero.
+        std::string s(text);
+        out = std::strtod(s.c_str(), nullptr);
+        return Status::OUT_OF_RANGE;
+    }
+    return ec == std::errc() ? Status::OK : Status::INVALID;
+}
@@ -0,0 +1,30 @@
+#ifndef NUMBER_HPP
+#define NUMBER_HPP
+
+#include <cstdint>
+#include <string_view>
+
+// Conversion of numeric literals to their values, done by the Lexer as it
+// reads them. Literals may contain '_' separators, which are skipped; the
+// Lexer checks where they are.
+//
+// Decimal integers go through a SWAR loop that takes 8 digits per step,
+// other bases through std::from_chars. Floats, hex floats included, use
+// std::from_chars too, which rounds exactly.
+namespace number {
+
+    enum class Status {
+        OK,
+        OUT_OF_RANGE, // the value is clamped, or the nearest double
+        INVALID,      // not a literal of this kind
+    };
+
+    // `digits` are those of a literal in `base` (2, 8, 10 or 16) without
+    // its prefix. No digits at all is INVALID.
+    Status to_int(std::string_view digits, int base, int64_t& out);
+    // `text` is a whole decimal float, or a hex one with its "0x" prefix,
+    // whose exponent is then a power of two after a 'p'.
+    Status to_float(std::string_view text, double& out);
+}
+
+#endif
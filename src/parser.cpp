@@ -1,35 +1,17 @@
 #include "parser.hpp"
-#include <iostream>
 #include <string>
 #include <limits.h>
+#include <algorithm>
+#include <cassert>
 
 
 using namespace AST;
 
-int lowest_prec = 0;
-
-static
-int precedence(Token tok) {
-    switch (tok) {
-        case Token::OR: return 1;
-        case Token::AND: return 2;
-        case Token::EQUAL:
-        case Token::NOTEQ:
-        case Token::LESS:
-        case Token::GREATER:
-        case Token::LESSEQ:
-        case Token::GREATEREQ:
-            return 3;
-        case Token::ADD:
-        case Token::SUB:
-            return 4;
-        case Token::MUL:
-        case Token::DIV:
-            return 5;
-        default:
-            return lowest_prec;
-    }
-}
+// Below every binary operator in token_table.
+static constexpr int lowest_prec = 0;
+// Above every binary operator: prefix operators apply to the operand
+// right after them.
+static constexpr int prefix_prec = INT8_MAX;
 
 static
 bool is_stmt_start(Token tok) {
@@ -49,71 +31,148 @@ bool is_stmt_start(Token tok) {
 
 
 
-void Parser::next() {
-    m_pos = m_lexer.get_pos();
-    tok = m_lexer.nextToken();
+template <class B>
+BasicParser<B>::BasicParser(std::string_view input, AST::ErrorHandler error_handler,
+                            ParseMode mode)
+: m_lexer(input, error_handler), error_handler(std::move(error_handler)) {
+    if (mode == ParseMode::BUFFERED && input.size() <= TokenBuffer::max_input) {
+        m_toks = m_lexer.tokenize();
+        m_buffered = true;
+    }
+    next();
+}
+
+template <class B>
+BasicParser<B>::BasicParser(TokenBuffer toks, AST::ErrorHandler error_handler)
+: m_lexer(toks.input, error_handler), m_buffered(true), m_toks(std::move(toks)),
+  error_handler(std::move(error_handler)) {
+    next();
+}
+
+template <class B>
+void BasicParser<B>::next() {
+    if (m_buffered) {
+        tok = m_toks.get(m_next);
+        if (m_next + 1 < m_toks.size()) // stay on ENDMARKER
+            m_next++;
+    } else if (!m_ahead.empty()) {
+        tok = m_ahead.front();
+        m_ahead.pop_front();
+    } else {
+        tok = m_lexer.nextToken();
+    }
+    m_pos = tok.pos;
+}
+
+template <class B>
+LexTok BasicParser<B>::peek(std::size_t n) {
+    assert(n >= 1);
+    if (m_buffered)
+        return m_toks.get(std::min(m_next + n - 1, m_toks.size() - 1));
+    while (m_ahead.size() < n)
+        m_ahead.push_back(m_lexer.nextToken());
+    return m_ahead[n - 1];
 }
 
-void Parser::error(std::size_t pos, std::string msg) {
-    FilePos fpos = FilePos_from_offset(pos, m_lexer.get_input());
+template <class B>
+void BasicParser<B>::error(std::size_t pos, std::string msg) {
+    FilePos fpos = m_lexer.file_pos(pos);
     error_handler(fpos, msg);
 }
 
-void Parser::error_expected(std::size_t pos, std::string msg) {
+template <class B>
+void BasicParser<B>::error_expected(std::size_t pos, std::string msg) {
     msg = "expected " + msg;
     error(pos, msg);
 }
 
-std::size_t Parser::expect(Token e) {
+template <class B>
+std::size_t BasicParser<B>::expect(Token e) {
     std::size_t pos = m_pos;
     if (tok != e) {
-        error_expected(pos, "'"+token_string[e]+"'");
+        error_expected(pos, "'" + std::string(token_spelling(e)) + "'");
     }
     next();
     return pos;
 }
 
-Program* Parser::parse_program() {
-    try {
-        Program* prog = new Program();
-        prog->stmts = parse_stmt_list();
-        return prog;
-    } catch (...) {
-        std::cout << "ERROR!!! Shouldn't have arrive here!!\n";
-        exit(1);
+template <class B>
+typename B::Result BasicParser<B>::parse_program() {
+    m_build.begin(m_lexer.get_input());
+    if (m_lexer.get_input().size() > B::max_input) {
+        error(0, "input too large");
+        return m_build.finish({});
     }
+    std::vector<Stmt> stmts = parse_stmt_list();
+    while (tok != Token::ENDMARKER) {
+        // parse_stmt_list() stops at a '}' that has no matching '{'
+        error(m_pos, "unexpected '}'");
+        next();
+        std::vector<Stmt> more = parse_stmt_list();
+        stmts.insert(stmts.end(), more.begin(), more.end());
+    }
+    return m_build.finish(std::move(stmts));
 }
 
-std::vector<Stmt*> Parser::parse_stmt_list() {
-    std::vector<Stmt*> ret;
-    while (tok != Token::RBRACE && tok != Token::ENDMARKER)
+template <class B>
+auto BasicParser<B>::parse_stmt_list() -> std::vector<Stmt> {
+    std::vector<Stmt> ret;
+    while (tok != Token::RBRACE && tok != Token::ENDMARKER) {
+        if (tok == Token::NEWLINE) { // empty statement
+            next();
+            continue;
+        }
         ret.push_back(parse_stmt());
+    }
     return ret;
 }
 
-Stmt* Parser::parse_stmt() {
+template <class B>
+void BasicParser<B>::expect_stmt_end() {
+    switch (tok.type) {
+        case Token::NEWLINE:
+            next();
+            return;
+        case Token::RBRACE:
+        case Token::ENDMARKER:
+            return;
+        default:
+            error_expected(m_pos, "newline");
+            // skip the rest of the line
+            while (tok != Token::NEWLINE && tok != Token::RBRACE && tok != Token::ENDMARKER)
+                next();
+            if (tok == Token::NEWLINE)
+                next();
+    }
+}
+
+template <class B>
+auto BasicParser<B>::parse_stmt() -> Stmt {
     switch (tok.type) {
         default:
             return parse_stmt_expr();
     }
 }
 
-StmtExpr* Parser::parse_stmt_expr() {
-    Expr* expr =  parse_expr();
-    StmtExpr* stmt = new StmtExpr(m_pos);
-    stmt->expr = expr;
-    //expect(Token::NEWLINE);
+template <class B>
+auto BasicParser<B>::parse_stmt_expr() -> Stmt {
+    std::size_t pos = m_pos;
+    Expr expr = parse_expr();
+    Stmt stmt = m_build.stmt_expr(pos, expr);
+    expect_stmt_end();
     return stmt;
 }
 
-Expr* Parser::parse_expr() {
-    Expr *expr = parse_binary_expr(lowest_prec);
+template <class B>
+auto BasicParser<B>::parse_expr() -> Expr {
+    Expr expr = parse_binary_expr(lowest_prec + 1);
     return expr;
 }
 
-IdentLit* Parser::parse_ident() {
-    IdentLit* ident = new IdentLit(m_pos);
-    std::string name = "_";
+template <class B>
+auto BasicParser<B>::parse_ident() -> Expr {
+    std::size_t pos = m_pos;
+    std::string_view name = "_";
 
     if (tok == Token::IDENT) {
         name = tok.literal;
@@ -122,88 +181,122 @@ IdentLit* Parser::parse_ident() {
         expect(Token::IDENT);
     }
 
-    ident->value = name;
-    return ident;
+    return m_build.ident(pos, name);
 }
 
-IntLit* Parser::parse_int() {
-    IntLit* num = new IntLit(m_pos);
-    char* e;
-    errno = 0;
-    int64_t value = std::strtoll(tok.literal.c_str(), &e, 0);
-    if (*e != '\0')
-        error(m_pos, "invalid integer");
-    if (errno != 0)
-        error(m_pos, "integer out of range");
-    num->value = value; 
+template <class B>
+auto BasicParser<B>::parse_string() -> Expr {
+    Expr str = m_build.string(m_pos, tok.literal);
     next();
-    return num; 
-}
-
-FloatLit* Parser::parse_float() {
-    char *e;
-    FloatLit* num = new FloatLit(m_pos);
-    errno = 0;
-    double value = std::strtod(tok.literal.c_str(), &e);
-    if (*e != '\0')
-        error(m_pos, "invalid float");
-    if (errno != 0)
-        error(m_pos, "float out of range");
-    num->value = value;
+    return str;
+}
+
+// The Lexer has worked out the values of number literals and reported
+// the ones it could not.
+template <class B>
+auto BasicParser<B>::parse_int() -> Expr {
+    Expr num = m_build.int_lit(m_pos, tok.value.i);
     next();
     return num;
 }
 
-Expr* Parser::parse_operand() {
+template <class B>
+auto BasicParser<B>::parse_float() -> Expr {
+    Expr num = m_build.float_lit(m_pos, tok.value.f);
+    next();
+    return num;
+}
+
+template <class B>
+auto BasicParser<B>::parse_operand() -> Expr {
     switch (tok.type) {
         case Token::IDENT:    return parse_ident();
+        case Token::STRING:   return parse_string();
         case Token::INT:      return parse_int();
         case Token::FLOAT:    return parse_float();
         default:
             error(m_pos, "invalid expression");
-            Expr* bad = new ExprBad(m_pos);
-            while (!is_stmt_start(tok.type) && tok != Token::ENDMARKER)
+            Expr bad = m_build.bad(m_pos);
+            while (!is_stmt_start(tok.type) && tok != Token::NEWLINE &&
+                   tok != Token::RBRACE && tok != Token::ENDMARKER)
                 next();
             return bad;
     }
 }
 
-Expr* Parser::parse_unary_expr() {
-    std::size_t pos = m_pos;
-    Token op = tok.type;
-    Expr *x;
-    ExprUnary *ret;
-    switch(tok.type) {
-        case Token::ADD:
-        case Token::SUB:
-        case Token::NOT:
+// Operator precedence parsing without recursion, so that neither long
+// chains of prefix operators nor long expressions use up the call stack.
+// Operators wait on m_ops until the next operator shows whether they take
+// the operand before it; the tree and the order its nodes are made in are
+// the same as those of recursive descent.
+template <class B>
+auto BasicParser<B>::parse_binary_expr(int prec1) -> Expr {
+    const std::size_t base = m_ops.size();
+    for (;;) {
+        while (token_is_prefix(tok.type)) {
+            m_ops.push_back({m_pos, tok.type, prefix_prec, Expr()});
             next();
-            x = parse_unary_expr();
-            ret = new ExprUnary(pos);
-            ret->op = op;
-            ret->right = x; 
-            return ret;
-        default:
-            return parse_operand();
-    }
-}
+        }
+        Expr x = parse_operand();
 
-Expr* Parser::parse_binary_expr(int prec1) {
-    Expr* left = parse_unary_expr();
-    for (;;) {
         Token op = tok.type;
-        int prec = precedence(op);
-
-        if (prec < prec1) return left;
+        int prec = token_precedence(op);
+        if (prec < prec1)
+            prec = lowest_prec;
+        // Apply the waiting operators that bind tighter than op.
+        while (m_ops.size() > base) {
+            PendingOp& top = m_ops.back();
+            if (top.prec < prec || (top.prec == prec && token_assoc(op) == TokenAssoc::RIGHT))
+                break;
+            if (top.prec == prefix_prec)
+                x = make_unary(top.pos, top.op, x);
+            else
+                x = make_binary(top.pos, top.left, top.op, x);
+            m_ops.pop_back();
+        }
+        if (prec == lowest_prec)
+            return x;
 
         std::size_t pos = expect(op);
+        m_ops.push_back({pos, op, prec, x});
+    }
+}
 
-        Expr *right = parse_binary_expr(prec + 1);
+template <class B>
+auto BasicParser<B>::make_const(std::size_t pos, fold::Const c) -> Expr {
+    return c.kind == fold::Const::INT ? m_build.int_lit(pos, c.i) : m_build.float_lit(pos, c.f);
+}
+
+template <class B>
+auto BasicParser<B>::make_unary(std::size_t pos, Token op, Expr x) -> Expr {
+    fold::Const cx, out;
+    if (m_fold && m_build.constant(x, cx)) {
+        fold::Status st = fold::unary(op, cx, out);
+        if (st == fold::Status::OK) {
+            m_build.discard(x);
+            return make_const(pos, out);
+        }
+        if (st != fold::Status::UNSUPPORTED)
+            error(pos, fold::message(st));
+    }
+    return m_build.unary(pos, op, x);
+}
 
-        ExprBinary* temp = new ExprBinary(pos);
-        temp->left = left;
-        temp->op = op;
-        temp->right = right; 
-        left = temp;
+template <class B>
+auto BasicParser<B>::make_binary(std::size_t pos, Expr left, Token op, Expr right) -> Expr {
+    fold::Const cl, cr, out;
+    if (m_fold && m_build.constant(left, cl) && m_build.constant(right, cr)) {
+        fold::Status st = fold::binary(op, cl, cr, out);
+        if (st == fold::Status::OK) {
+            m_build.discard(right);
+            m_build.discard(left);
+            return make_const(pos, out);
+        }
+        if (st != fold::Status::UNSUPPORTED)
+            error(pos, fold::message(st));
     }
-}
\ No newline at end of file
+    return m_build.binary(pos, left, op, right);
+}
+
+template class BasicParser<AST::TreeBuilder>;
+template class BasicParser<AST::Flat::Builder>;
@@ -3,35 +3,103 @@
 
 #include "lexer.hpp"
 #include "ast.hpp"
+#include "flat_ast.hpp"
+#include <deque>
 
 
-class Parser {
+enum class ParseMode {
+    STREAM,   // pull tokens from the Lexer as parsing goes
+    BUFFERED, // lex the whole input into a TokenBuffer up front
+};
+
+
+// The parser is written once and produces whatever tree its Builder makes:
+// AST::TreeBuilder gives the pointer-based AST::Program, AST::Flat::Builder
+// the index-based AST::Flat::Tree. Parse functions pass around the builder's
+// Expr/Stmt handles and never touch nodes directly.
+template <class Builder>
+class BasicParser {
+    using Expr = typename Builder::Expr;
+    using Stmt = typename Builder::Stmt;
+
     Lexer m_lexer;
     LexTok tok;
     std::size_t m_pos;
+    Builder m_build;
+
+    // BUFFERED mode walks m_toks; STREAM mode keeps the tokens it has
+    // peeked at in m_ahead.
+    bool m_buffered = false;
+    TokenBuffer m_toks;
+    std::size_t m_next = 0;
+    std::deque<LexTok> m_ahead;
+
+    bool m_fold = false;
+
+    // Operators parse_binary_expr() has read and not yet applied, innermost
+    // last. Kept between calls so that its storage is reused.
+    struct PendingOp {
+        std::size_t pos;
+        Token op;
+        int prec;   // prefix_prec for a prefix operator
+        Expr left;  // of a binary operator
+    };
+    std::vector<PendingOp> m_ops;
 
     void next();
-    AST::IdentLit* parse_ident();
-    AST::IntLit* parse_int();
-    AST::FloatLit* parse_float();
-    AST::Expr* parse_binary_expr(int prec1);
-    AST::Expr* parse_unary_expr();
-    AST::Expr* parse_operand();
-    AST::Expr* parse_expr();
-    AST::Stmt* parse_stmt();
-    AST::StmtExpr* parse_stmt_expr();
-    std::vector<AST::Stmt*> parse_stmt_list();
+    Expr parse_ident();
+    Expr parse_string();
+    Expr parse_int();
+    Expr parse_float();
+    Expr parse_binary_expr(int prec1);
+    Expr parse_operand();
+    Expr parse_expr();
+    // Build an operator node, or its value when folding and the operands
+    // are literals.
+    Expr make_unary(std::size_t pos, Token op, Expr x);
+    Expr make_binary(std::size_t pos, Expr left, Token op, Expr right);
+    Expr make_const(std::size_t pos, fold::Const c);
+    Stmt parse_stmt();
+    Stmt parse_stmt_expr();
+    std::vector<Stmt> parse_stmt_list();
 
 
     // Handling errors
-    void (*error_handler) (AST::FilePos, std::string);
+    AST::ErrorHandler error_handler;
     std::size_t expect(Token tok);
+    // Statements end at a newline (or ';'), a '}' or the end of input.
+    void expect_stmt_end();
     void error_expected(std::size_t pos, std::string wanted);
     void error(std::size_t pos, std::string msg);
 public:
-    explicit Parser(const std::string& input, void (*error_handler)(AST::FilePos, std::string))
-    : m_lexer(input, error_handler), error_handler(error_handler) {}
-    AST::Program* parse_program();    
+    using Result = typename Builder::Result;
+
+    // The returned tree refers into `input`, which must outlive it.
+    // Inputs too large for a TokenBuffer are always parsed in STREAM mode.
+    explicit BasicParser(std::string_view input, AST::ErrorHandler error_handler,
+                         ParseMode mode = ParseMode::STREAM);
+    // Parses tokens that have already been lexed, e.g. by Lexer::tokenize(ThreadPool&).
+    explicit BasicParser(TokenBuffer toks, AST::ErrorHandler error_handler);
+    // With folding on, operators on literal operands are evaluated while
+    // the tree is built (see fold.hpp); an operation that would divide by
+    // zero or overflow is reported and kept as it is.
+    void set_folding(bool on) { m_fold = on; }
+    // With sharing on, equal subexpressions are built once and shared;
+    // see TreeBuilder::set_sharing.
+    void set_sharing(bool on) { m_build.set_sharing(on); }
+    // The n-th token after the current one, n >= 1, without consuming
+    // anything; ENDMARKER past the end. Before parsing, the current token
+    // is the first one.
+    LexTok peek(std::size_t n = 1);
+    // Exceptions, std::bad_alloc from the arena or whatever the error
+    // handler throws, are passed on to the caller.
+    Result parse_program();    
 };
 
-#endif
\ No newline at end of file
+using Parser = BasicParser<AST::TreeBuilder>;
+using FlatParser = BasicParser<AST::Flat::Builder>;
+
+extern template class BasicParser<AST::TreeBuilder>;
+extern template class BasicParser<AST::Flat::Builder>;
+
+#endif
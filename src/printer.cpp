@@ -0,0 +1,154 @@
+#include "printer.hpp"
+#include "visitor.hpp"
+#include <charconv>
+
+using namespace AST;
+
+
+void Printer::int_lit(int64_t value) {
+    char tmp[24];
+    buf.append(tmp, std::to_chars(tmp, tmp + sizeof tmp, value).ptr);
+}
+
+void Printer::float_lit(double value) {
+    // %f of the largest double is 316 characters.
+    char tmp[512];
+    std::to_chars_result r = format == PrintFormat::HUMAN
+        ? std::to_chars(tmp, tmp + sizeof tmp, value, std::chars_format::fixed, 6)
+        : std::to_chars(tmp, tmp + sizeof tmp, value);
+    buf.append(tmp, r.ptr);
+    // Keep floats apart from ints in the compact form.
+    if (format == PrintFormat::COMPACT &&
+        std::string_view(tmp, r.ptr - tmp).find_first_of(".einf") == std::string_view::npos)
+        buf += ".0";
+}
+
+void Printer::string_lit(std::string_view value) {
+    // The spelling is as written in the source, escapes and all.
+    if (format == PrintFormat::COMPACT)
+        buf += '"';
+    buf += value;
+    if (format == PrintFormat::COMPACT)
+        buf += '"';
+}
+
+// A unary or binary operator, HUMAN: "op " before the operand or " op "
+// between the two; COMPACT: "(op " before them, " " between them.
+void Printer::open(Token op) {
+    if (format == PrintFormat::COMPACT)
+        buf += '(';
+    buf += token_spelling(op);
+    buf += ' ';
+}
+
+void Printer::sep(Token op) {
+    buf += ' ';
+    if (format == PrintFormat::HUMAN) {
+        buf += token_spelling(op);
+        buf += ' ';
+    }
+}
+
+void Printer::close() {
+    if (format == PrintFormat::COMPACT)
+        buf += ')';
+}
+
+void Printer::end_stmt() {
+    buf += '\n';
+    spill();
+}
+
+void Printer::flush() {
+    if (sink && !buf.empty()) {
+        sink->write(buf.data(), buf.size());
+        buf.clear();
+    }
+}
+
+// Emits each node on the way down and up an iterative walk, so deep trees
+// print without deep recursion.
+template <class Access>
+class AST::PrintWalker : public Walker<PrintWalker<Access>, Access> {
+    Printer& p;
+public:
+    using Handle = typename Access::Handle;
+
+    PrintWalker(Printer& p, Access access)
+    : Walker<PrintWalker<Access>, Access>(access), p(p) {}
+
+    bool pre(Handle n) {
+        // Before every node, so that not even one huge statement has to
+        // fit in the buffer.
+        p.spill();
+        const Access& a = this->access;
+        switch (a.type(n)) {
+            case EXPR_LIT_IDENT:
+                p.text(a.spelling(n));
+                return false;
+            case EXPR_LIT_STRING:
+                p.string_lit(a.spelling(n));
+                return false;
+            case EXPR_LIT_INT:
+                p.int_lit(a.int_value(n));
+                return false;
+            case EXPR_LIT_FLOAT:
+                p.float_lit(a.float_value(n));
+                return false;
+            case EXPR_BAD:
+                p.text(p.format == PrintFormat::HUMAN ? "<INVALID EXPRESSION>" : "(bad)");
+                return false;
+            case EXPR_UNARY:
+                p.open(a.op(n));
+                return true;
+            case EXPR_BINARY:
+                if (p.format == PrintFormat::COMPACT)
+                    p.open(a.op(n));
+                return true;
+            default:
+                return true;
+        }
+    }
+
+    void between(Handle n, std::size_t) {
+        if (this->access.type(n) == EXPR_BINARY)
+            p.sep(this->access.op(n));
+    }
+
+    void post(Handle n) {
+        switch (this->access.type(n)) {
+            case EXPR_UNARY:
+            case EXPR_BINARY:
+                p.close();
+                break;
+            case STMT_EXPR:
+                p.end_stmt();
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+void Printer::print(Node* n) {
+    PrintWalker<PointerAccess>(*this, PointerAccess()).walk(n);
+}
+
+void Printer::print(const Flat::Tree& tree) {
+    PrintWalker<FlatAccess> walker(*this, FlatAccess(tree));
+    for (Flat::Ref stmt : tree.stmts)
+        walker.walk(stmt);
+}
+
+
+std::string Node::string() {
+    Printer p;
+    p.print(this);
+    return p.take();
+}
+
+std::string Flat::Tree::string() const {
+    Printer p;
+    p.print(*this);
+    return p.take();
+}
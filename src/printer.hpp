@@ -0,0 +1,66 @@
+#ifndef PRINTER_HPP
+#define PRINTER_HPP
+
+#include <ostream>
+#include <string>
+#include "ast.hpp"
+#include "flat_ast.hpp"
+
+namespace AST {
+
+    enum class PrintFormat {
+        HUMAN,   // infix, one statement per line; what Node::string() gives
+        COMPACT, // fully parenthesized prefix form, one statement per line,
+                 // floats in shortest round-trip form
+    };
+
+    template <class Access> class PrintWalker;
+
+    // Writes trees into one growable buffer, appending each token in place
+    // rather than building a string per node. The buffer keeps its capacity
+    // across clear(), so a Printer can be reused for many trees. Given a
+    // stream, the Printer writes the buffer out whenever it passes
+    // flush_size, also in the middle of a statement, so its memory stays
+    // bounded however large the tree.
+    class Printer {
+        std::string buf;
+        std::ostream* sink = nullptr;
+        PrintFormat format;
+
+        void text(std::string_view s) { buf += s; }
+        void int_lit(int64_t value);
+        void float_lit(double value);
+        void string_lit(std::string_view value);
+        void open(Token op);
+        void sep(Token op);
+        void close();
+        void end_stmt();
+        void spill() {
+            if (sink && buf.size() >= flush_size)
+                flush();
+        }
+
+        template <class Access> friend class PrintWalker;
+    public:
+        static constexpr std::size_t flush_size = 1 << 16;
+
+        explicit Printer(PrintFormat format = PrintFormat::HUMAN) : format(format) {}
+        explicit Printer(std::ostream& sink, PrintFormat format = PrintFormat::HUMAN)
+        : sink(&sink), format(format) {}
+        Printer(const Printer&) = delete;
+        Printer& operator=(const Printer&) = delete;
+        ~Printer() { flush(); }
+
+        void print(Node* node);
+        void print(const Flat::Tree& tree);
+
+        // Without a stream, the output so far.
+        const std::string& str() const { return buf; }
+        std::string take() { return std::exchange(buf, std::string()); }
+        void clear() { buf.clear(); }
+        // Writes the buffer to the stream, if there is one.
+        void flush();
+    };
+}
+
+#endif
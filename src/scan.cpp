@@ -0,0 +1,302 @@
+#include "scan.hpp"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+
+static inline
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline
+bool is_ident(char c) {
+    return ('a' <= c && c <= 'z') ||
+        ('A' <= c && c <= 'Z') ||
+        ('0' <= c && c <= '9') ||
+        (c == '_');
+}
+
+static inline
+bool is_string_special(char c) {
+    return c == '"' || c == '\\' || c == '\n' || c == '\0';
+}
+
+/*
+ * Scalar
+ */
+
+static
+const char* space_scalar(const char* p, const char* end) {
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+static
+const char* ident_scalar(const char* p, const char* end) {
+    while (p < end && is_ident(*p)) p++;
+    return p;
+}
+
+static
+const char* line_scalar(const char* p, const char* end) {
+    while (p < end && *p != '\n') p++;
+    return p;
+}
+
+static
+const char* string_scalar(const char* p, const char* end) {
+    while (p < end && !is_string_special(*p)) p++;
+    return p;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * SSE2, always available on x86-64.
+ * Every block computes a mask with a bit set for each byte that continues
+ * the run; the first clear bit is where the run ends.
+ */
+
+static inline
+__m128i in_range_128(__m128i v, char lo, char hi) {
+    // Signed compares: bytes >= 0x80 are negative and never in range.
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), v));
+}
+
+static inline
+unsigned space_mask_128(__m128i v) {
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    return _mm_movemask_epi8(m);
+}
+
+static inline
+unsigned ident_mask_128(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(in_range_128(lower, 'a', 'z'), in_range_128(v, '0', '9')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    return _mm_movemask_epi8(m);
+}
+
+static inline
+unsigned line_mask_128(__m128i v) {
+    return ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))) & 0xFFFF;
+}
+
+static inline
+unsigned string_mask_128(__m128i v) {
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                     _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+    return ~_mm_movemask_epi8(m) & 0xFFFF;
+}
+
+template <unsigned (*Mask)(__m128i), const char* (*Tail)(const char*, const char*)>
+static inline
+const char* run_128(const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned stop = ~Mask(v) & 0xFFFF;
+        if (stop)
+            return p + __builtin_ctz(stop);
+        p += 16;
+    }
+    return Tail(p, end);
+}
+
+static
+const char* space_sse2(const char* p, const char* end) {
+    return run_128<space_mask_128, space_scalar>(p, end);
+}
+
+static
+const char* ident_sse2(const char* p, const char* end) {
+    return run_128<ident_mask_128, ident_scalar>(p, end);
+}
+
+static
+const char* line_sse2(const char* p, const char* end) {
+    return run_128<line_mask_128, line_scalar>(p, end);
+}
+
+static
+const char* string_sse2(const char* p, const char* end) {
+    return run_128<string_mask_128, string_scalar>(p, end);
+}
+
+/*
+ * AVX2, compiled for that target only and used when the CPU has it.
+ */
+
+#define SCAN_AVX2 __attribute__((target("avx2")))
+
+SCAN_AVX2 static inline
+__m256i in_range_256(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+SCAN_AVX2 static inline
+uint32_t space_mask_256(__m256i v) {
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+    return _mm256_movemask_epi8(m);
+}
+
+SCAN_AVX2 static inline
+uint32_t ident_mask_256(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(in_range_256(lower, 'a', 'z'), in_range_256(v, '0', '9')),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    return _mm256_movemask_epi8(m);
+}
+
+SCAN_AVX2 static inline
+uint32_t line_mask_256(__m256i v) {
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+}
+
+SCAN_AVX2 static inline
+uint32_t string_mask_256(__m256i v) {
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                        _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(m));
+}
+
+template <uint32_t (*Mask)(__m256i), const char* (*Tail)(const char*, const char*)>
+SCAN_AVX2 static inline
+const char* run_256(const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t stop = ~Mask(v);
+        if (stop)
+            return p + __builtin_ctz(stop);
+        p += 32;
+    }
+    return Tail(p, end);
+}
+
+SCAN_AVX2 static
+const char* space_avx2(const char* p, const char* end) {
+    return run_256<space_mask_256, space_sse2>(p, end);
+}
+
+SCAN_AVX2 static
+const char* ident_avx2(const char* p, const char* end) {
+    return run_256<ident_mask_256, ident_sse2>(p, end);
+}
+
+SCAN_AVX2 static
+const char* line_avx2(const char* p, const char* end) {
+    return run_256<line_mask_256, line_sse2>(p, end);
+}
+
+SCAN_AVX2 static
+const char* string_avx2(const char* p, const char* end) {
+    return run_256<string_mask_256, string_sse2>(p, end);
+}
+
+#undef SCAN_AVX2
+
+#endif // SCAN_X86
+
+
+struct ScanTable {
+    scan::Impl impl;
+    scan::Scanner space;
+    scan::Scanner ident;
+    scan::Scanner line;
+    scan::Scanner string;
+};
+
+static const ScanTable scalar_table {
+    scan::Impl::SCALAR, space_scalar, ident_scalar, line_scalar, string_scalar
+};
+
+#ifdef SCAN_X86
+static const ScanTable sse2_table {
+    scan::Impl::SSE2, space_sse2, ident_sse2, line_sse2, string_sse2
+};
+static const ScanTable avx2_table {
+    scan::Impl::AVX2, space_avx2, ident_avx2, line_avx2, string_avx2
+};
+#endif
+
+static
+bool supported(scan::Impl impl) {
+    switch (impl) {
+        case scan::Impl::SCALAR:
+            return true;
+#ifdef SCAN_X86
+        case scan::Impl::SSE2:
+            return true;
+        case scan::Impl::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+static
+const ScanTable* table_for(scan::Impl impl) {
+    switch (impl) {
+#ifdef SCAN_X86
+        case scan::Impl::SSE2: return &sse2_table;
+        case scan::Impl::AVX2: return &avx2_table;
+#endif
+        default: return &scalar_table;
+    }
+}
+
+static
+const ScanTable*& current() {
+    static const ScanTable* table = table_for(
+        supported(scan::Impl::AVX2) ? scan::Impl::AVX2 :
+        supported(scan::Impl::SSE2) ? scan::Impl::SSE2 :
+        scan::Impl::SCALAR);
+    return table;
+}
+
+const char* scan::space(const char* p, const char* end) {
+    return current()->space(p, end);
+}
+
+const char* scan::ident(const char* p, const char* end) {
+    return current()->ident(p, end);
+}
+
+const char* scan::line(const char* p, const char* end) {
+    return current()->line(p, end);
+}
+
+const char* scan::string(const char* p, const char* end) {
+    return current()->string(p, end);
+}
+
+scan::Impl scan::active() {
+    return current()->impl;
+}
+
+bool scan::select(Impl impl) {
+    if (!supported(impl))
+        return false;
+    current() = table_for(impl);
+    return true;
+}
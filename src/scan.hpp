@@ -0,0 +1,39 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+// Bulk scanners used by the Lexer to skip over runs of bytes that need no
+// per-byte handling. Each scanner takes a range [p, end) and returns a pointer
+// to the first byte that ends the run, or `end` if the whole range matches.
+//
+// On x86-64 the scanners look at 16 (SSE2) or 32 (AVX2) bytes at a time; the
+// widest implementation the CPU supports is picked on first use. Other targets
+// use the scalar loops.
+
+namespace scan {
+
+    using Scanner = const char* (*)(const char* p, const char* end);
+
+    // Skips ' ', '\t' and '\r'. Newlines are not considered ordinary space.
+    const char* space(const char* p, const char* end);
+    // Skips [A-Za-z0-9_].
+    const char* ident(const char* p, const char* end);
+    // Stops at '\n'.
+    const char* line(const char* p, const char* end);
+    // Stops at the bytes that need attention inside a string literal:
+    // '"', '\\', '\n' and '\0'.
+    const char* string(const char* p, const char* end);
+
+    enum class Impl {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    // Returns the implementation currently in use.
+    Impl active();
+    // Forces an implementation, e.g. for testing or benchmarking.
+    // Returns false if the CPU doesn't support it.
+    bool select(Impl impl);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#include "source.hpp"
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+Source& Source::operator=(Source&& other) noexcept {
+    if (this != &other) {
+        close();
+        m_path = std::move(other.m_path);
+        m_map = std::exchange(other.m_map, nullptr);
+        m_map_len = std::exchange(other.m_map_len, 0);
+        bool buffered = !m_map && !other.m_text.empty();
+        m_buf = std::move(other.m_buf);
+        m_text = buffered ? std::string_view(m_buf) : other.m_text;
+        other.m_text = {};
+    }
+    return *this;
+}
+
+void Source::close() {
+    if (m_map)
+        munmap(m_map, m_map_len);
+    m_map = nullptr;
+    m_map_len = 0;
+    m_buf.clear();
+    m_text = {};
+}
+
+static
+bool read_all(int fd, std::string& buf, std::string& err) {
+    char chunk[64 * 1024];
+    for (;;) {
+        ssize_t n = read(fd, chunk, sizeof chunk);
+        if (n == 0)
+            return true;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            err = std::strerror(errno);
+            return false;
+        }
+        buf.append(chunk, n);
+    }
+}
+
+bool Source::open(const std::string& path, std::string& err) {
+    close();
+    m_path = path;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        err = std::strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        err = std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    bool ok = true;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            m_map = map;
+            m_map_len = st.st_size;
+            m_text = std::string_view(static_cast<const char*>(map), m_map_len);
+        } else {
+            ok = read_all(fd, m_buf, err);
+            m_text = m_buf;
+        }
+    } else if (!S_ISREG(st.st_mode)) {
+        ok = read_all(fd, m_buf, err);
+        m_text = m_buf;
+    }
+    // An empty regular file can't be mapped and needs nothing.
+
+    ::close(fd);
+    return ok;
+}
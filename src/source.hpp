@@ -0,0 +1,35 @@
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <string>
+#include <string_view>
+
+// The contents of a source file. Regular files are mapped read-only instead
+// of being copied onto the heap; anything that can't be mapped (pipes,
+// terminals) is read into a buffer. Either way text() stays valid, and so
+// do the tokens and trees that point into it, until the Source is destroyed.
+class Source {
+    std::string m_path;
+    std::string_view m_text;
+    void* m_map = nullptr;
+    std::size_t m_map_len = 0;
+    std::string m_buf;
+
+    void close();
+public:
+    Source() = default;
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+    Source(Source&& other) noexcept { *this = std::move(other); }
+    Source& operator=(Source&& other) noexcept;
+    ~Source() { close(); }
+
+    // Returns false and sets `err` if the file can't be read.
+    bool open(const std::string& path, std::string& err);
+
+    const std::string& path() const { return m_path; }
+    std::string_view text() const { return m_text; }
+    bool mapped() const { return m_map != nullptr; }
+};
+
+#endif
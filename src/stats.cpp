@@ -0,0 +1,245 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include <sys/resource.h>
+#include "lexer.hpp"
+#include "visitor.hpp"
+
+/*
+ * The allocation hook. Replacing the plain forms is enough: the array and
+ * nothrow forms call them.
+ */
+
+void* operator new(std::size_t size) {
+    stats::note_alloc(size);
+    for (;;) {
+        if (void* p = std::malloc(size ? size : 1))
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+
+const char* const stats::phase_names[PHASES] = {
+    "read", "lex", "parse", "print", "emit", "run", "report",
+};
+
+static const char* const node_names[] = {
+    "program", "stmt_expr", "stmt_if", "stmt_for", "stmt_while", "stmt_let",
+    "string", "int", "float", "ident", "unary", "binary", "bad",
+};
+static_assert(std::size(node_names) == AST::EXPR_BAD + 1, "a name for every NodeType");
+
+static const auto start_time = std::chrono::steady_clock::now();
+
+double stats::now() {
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start_time;
+    return d.count();
+}
+
+static
+double cpu_clock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double stats::thread_cpu() {
+    return cpu_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+double stats::process_cpu() {
+    return cpu_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+long stats::peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static
+unsigned thread_id() {
+    static std::atomic<unsigned> next{0};
+    thread_local unsigned id = next++;
+    return id;
+}
+
+void stats::Timer::start() {
+    outer = allocs;
+    allocs = &s->phases[phase].allocs;
+    wall0 = now();
+    cpu0 = process ? process_cpu() : thread_cpu();
+}
+
+void stats::Timer::stop() {
+    if (!s)
+        return;
+    double wall = now();
+    PhaseStats& p = s->phases[phase];
+    p.wall += wall - wall0;
+    p.cpu += (process ? process_cpu() : thread_cpu()) - cpu0;
+    allocs = outer;
+    if (s->tracing)
+        s->spans.push_back({phase_names[phase], s->file, wall0, wall - wall0, thread_id()});
+    s = nullptr;
+}
+
+void stats::file_span(Stats* s, double start) {
+    s->files++;
+    if (s->tracing)
+        s->spans.push_back({s->file, s->file, start, now() - start, thread_id()});
+}
+
+void stats::Stats::count_tokens(const TokenBuffer& toks) {
+    for (const PackedTok& t : toks.toks)
+        tokens[std::size_t(t.type)]++;
+}
+
+void stats::Stats::count_nodes(AST::Program* prog) {
+    struct Count : AST::Walker<Count> {
+        uint64_t* nodes;
+        bool pre(AST::Node* n) { nodes[n->type()]++; return true; }
+    } count;
+    count.nodes = nodes;
+    count.walk(prog);
+}
+
+void stats::Stats::add(const Stats& other) {
+    for (int i = 0; i < PHASES; i++) {
+        phases[i].wall += other.phases[i].wall;
+        phases[i].cpu += other.phases[i].cpu;
+        phases[i].allocs.count += other.phases[i].allocs.count;
+        phases[i].allocs.bytes += other.phases[i].allocs.bytes;
+    }
+    for (std::size_t i = 0; i < std::size(tokens); i++)
+        tokens[i] += other.tokens[i];
+    for (std::size_t i = 0; i < std::size(nodes); i++)
+        nodes[i] += other.nodes[i];
+    files += other.files;
+    uncounted += other.uncounted;
+    bytes += other.bytes;
+    spans.insert(spans.end(), other.spans.begin(), other.spans.end());
+}
+
+/*
+ * Output
+ */
+
+static
+void appendf(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static
+void appendf(std::string& out, const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = std::vsnprintf(buf, sizeof buf, fmt, args);
+    va_end(args);
+    out.append(buf, std::min<std::size_t>(n, sizeof buf - 1));
+}
+
+static
+std::string json_string(std::string_view s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (uint8_t(c) < 0x20) {
+            appendf(out, "\\u%04x", c);
+        } else {
+            out += c;
+        }
+    }
+    return out + '"';
+}
+
+std::string stats::table(const Stats& s, double wall) {
+    std::string out;
+    // Summed over files, which may have run in parallel.
+    appendf(out, "%-8s %10s %10s %10s %10s\n", "phase", "wall ms", "cpu ms", "allocs", "alloc KiB");
+    for (int i = 0; i < PHASES; i++) {
+        const PhaseStats& p = s.phases[i];
+        appendf(out, "%-8s %10.3f %10.3f %10llu %10.1f\n", phase_names[i], p.wall * 1e3, p.cpu * 1e3,
+                (unsigned long long)p.allocs.count, p.allocs.bytes / 1024.0);
+    }
+    appendf(out, "%llu files, %llu bytes in %.3f ms (%.3f ms cpu), peak RSS %ld KiB\n",
+            (unsigned long long)s.files, (unsigned long long)s.bytes, wall * 1e3, process_cpu() * 1e3,
+            peak_rss_kb());
+
+    out += "tokens:";
+    if (s.uncounted)
+        appendf(out, " (not counted for %llu files read from the cache or too large to buffer)",
+                (unsigned long long)s.uncounted);
+    for (std::size_t i = 0; i < std::size(s.tokens); i++)
+        if (s.tokens[i])
+            appendf(out, " %.*s %llu", int(token_table[i].spelling.size()), token_table[i].spelling.data(),
+                    (unsigned long long)s.tokens[i]);
+    out += "\nnodes:";
+    for (std::size_t i = 0; i < std::size(s.nodes); i++)
+        if (s.nodes[i])
+            appendf(out, " %s %llu", node_names[i], (unsigned long long)s.nodes[i]);
+    return out + '\n';
+}
+
+std::string stats::json(const Stats& s, double wall) {
+    std::string out = "{\"phases\": {";
+    for (int i = 0; i < PHASES; i++) {
+        const PhaseStats& p = s.phases[i];
+        appendf(out, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f, \"allocs\": %llu, \"alloc_bytes\": %llu}",
+                i ? ", " : "", phase_names[i], p.wall, p.cpu,
+                (unsigned long long)p.allocs.count, (unsigned long long)p.allocs.bytes);
+    }
+    out += "}, \"tokens\": {";
+    const char* sep = "";
+    for (std::size_t i = 0; i < std::size(s.tokens); i++) {
+        if (s.tokens[i]) {
+            appendf(out, "%s%s: %llu", sep, json_string(token_table[i].spelling).c_str(),
+                    (unsigned long long)s.tokens[i]);
+            sep = ", ";
+        }
+    }
+    out += "}, \"nodes\": {";
+    sep = "";
+    for (std::size_t i = 0; i < std::size(s.nodes); i++) {
+        if (s.nodes[i]) {
+            appendf(out, "%s\"%s\": %llu", sep, node_names[i], (unsigned long long)s.nodes[i]);
+            sep = ", ";
+        }
+    }
+    appendf(out, "}, \"files\": %llu, \"uncounted_files\": %llu, \"bytes\": %llu, \"wall\": %.6f, \"cpu\": %.6f, "
+            "\"peak_rss_kb\": %ld}\n", (unsigned long long)s.files, (unsigned long long)s.uncounted,
+            (unsigned long long)s.bytes, wall, process_cpu(), peak_rss_kb());
+    return out;
+}
+
+std::string stats::trace(const std::vector<Span>& spans) {
+    // Complete ("X") events, in microseconds.
+    std::string out = "{\"traceEvents\": [\n";
+    for (std::size_t i = 0; i < spans.size(); i++) {
+        const Span& sp = spans[i];
+        out += "{\"name\": " + json_string(sp.name) + ", \"cat\": \"compile\", \"ph\": \"X\"";
+        appendf(out, ", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u", sp.start * 1e6, sp.dur * 1e6, sp.tid);
+        out += ", \"args\": {\"file\": " + json_string(sp.file) + "}}";
+        out += i + 1 < spans.size() ? ",\n" : "\n";
+    }
+    return out + "]}\n";
+}
@@ -0,0 +1,131 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "token.hpp"
+#include "ast.hpp"
+
+struct TokenBuffer;
+
+// Instrumentation for --stats: wall and CPU time, heap allocations per
+// phase, tokens by kind and nodes by type, and spans for a trace.
+//
+// Everything is gathered into a Stats owned by whoever runs the phases,
+// one per file, so that threads compiling different files share nothing;
+// the driver adds them up at the end. Code that takes a Stats* does
+// nothing with a null one, which leaves a branch per phase and a
+// thread-local load per allocation when statistics are off.
+namespace stats {
+
+    enum Phase {
+        READ,   // opening or mapping the source
+        LEX,
+        PARSE,  // lexing too, where the two aren't separate
+        PRINT,  // --ast
+        EMIT,   // --emit-c
+        RUN,    // --run, compiling to bytecode included
+        REPORT, // writing diagnostics and results
+        PHASES
+    };
+    extern const char* const phase_names[PHASES];
+
+    struct Allocs {
+        uint64_t count = 0;
+        uint64_t bytes = 0;
+    };
+
+    // Where heap allocations made on this thread are counted, if anywhere.
+    // Allocations are counted by operator new and by Arena blocks.
+    inline thread_local Allocs* allocs = nullptr;
+
+    inline void note_alloc(std::size_t size) {
+        if (Allocs* a = allocs) {
+            a->count++;
+            a->bytes += size;
+        }
+    }
+
+    // Seconds since the program started, and CPU seconds of the calling
+    // thread and of the whole process.
+    double now();
+    double thread_cpu();
+    double process_cpu();
+    long peak_rss_kb();
+
+    struct PhaseStats {
+        double wall = 0;
+        double cpu = 0;
+        Allocs allocs;
+    };
+
+    // A span of a trace; `tid` is a small number for each thread.
+    struct Span {
+        std::string name;
+        std::string file;
+        double start;
+        double dur;
+        unsigned tid;
+    };
+
+    struct Stats {
+        PhaseStats phases[PHASES];
+        uint64_t tokens[std::size(token_table)] = {};
+        uint64_t nodes[AST::EXPR_BAD + 1] = {};
+        uint64_t files = 0;
+        // Files that were never lexed on their own, whose tokens are not
+        // in `tokens` and whose lexing, if any, is part of PARSE: cache
+        // hits and inputs too large to buffer.
+        uint64_t uncounted = 0;
+        uint64_t bytes = 0;
+        bool tracing = false;
+        std::string file; // for spans
+        std::vector<Span> spans; // when tracing
+
+        void count_tokens(const TokenBuffer& toks);
+        // Nodes as a walk meets them, so a node shared by sharing is
+        // counted where it occurs.
+        void count_nodes(AST::Program* prog);
+        void add(const Stats& other);
+    };
+
+    // Measures one phase into `s`, from construction to stop() or the
+    // end of the scope. Phases shouldn't nest: an inner one takes the
+    // allocations of the outer while it runs. With `process` the CPU time
+    // is that of the whole process, for phases run on a ThreadPool; their
+    // workers' allocations are still not counted.
+    class Timer {
+        Stats* s;
+        Phase phase;
+        bool process;
+        double wall0 = 0;
+        double cpu0 = 0;
+        Allocs* outer = nullptr;
+
+        void start();
+    public:
+        Timer(Stats* s, Phase phase, bool process = false) : s(s), phase(phase), process(process) {
+            if (s)
+                start();
+        }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+        ~Timer() { stop(); }
+
+        void stop();
+    };
+
+    // Adds a span covering one whole file to its Stats.
+    void file_span(Stats* s, double start);
+
+    // The report of --stats over a run that took `wall` seconds.
+    std::string table(const Stats& s, double wall);
+    std::string json(const Stats& s, double wall);
+    // Chrome's trace event format, for chrome://tracing or Perfetto.
+    std::string trace(const std::vector<Span>& spans);
+}
+
+#endif
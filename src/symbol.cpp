@@ -0,0 +1,131 @@
+#include "symbol.hpp"
+#include "arena.hpp"
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// A Symbol is the index of its spelling within its shard, followed by the
+// shard number in the low bits.
+static constexpr unsigned shard_bits = 6;
+static constexpr std::size_t shard_count = std::size_t(1) << shard_bits;
+static constexpr std::size_t max_per_shard = std::size_t(1) << (32 - shard_bits);
+
+// The spellings of a shard live in chunks that double in size and never
+// move, so readers can index them while a writer appends. Chunk c holds
+// first_chunk << c entries; chunk_count of them cover max_per_shard.
+static constexpr unsigned first_chunk_bits = 8;
+static constexpr std::size_t first_chunk = std::size_t(1) << first_chunk_bits;
+static constexpr unsigned chunk_count = 32 - shard_bits - first_chunk_bits + 1;
+
+struct Slot {
+    uint32_t tag;   // high bits of the hash
+    uint32_t index; // index + 1 of the spelling; 0 if the slot is free
+};
+
+struct alignas(64) SymbolTable::Shard {
+    std::mutex mu;
+    uint32_t count = 0;
+    std::vector<Slot> slots; // open addressing, at most half full
+    std::atomic<std::string_view*> chunks[chunk_count] = {};
+    Arena pool;              // the spellings themselves
+
+    ~Shard() {
+        for (auto& chunk : chunks)
+            delete[] chunk.load(std::memory_order_relaxed);
+    }
+
+    std::string_view& entry(uint32_t index) const {
+        std::size_t i = index + first_chunk;
+        unsigned c = std::bit_width(i) - 1 - first_chunk_bits;
+        return chunks[c].load(std::memory_order_acquire)[i - (first_chunk << c)];
+    }
+
+    uint32_t append(std::string_view name) {
+        if (count == max_per_shard)
+            throw std::length_error("too many symbols");
+        std::size_t i = count + first_chunk;
+        unsigned c = std::bit_width(i) - 1 - first_chunk_bits;
+        if (i == (first_chunk << c))
+            chunks[c].store(new std::string_view[first_chunk << c], std::memory_order_release);
+
+        char* copy = static_cast<char*>(pool.allocate(name.size(), 1));
+        std::memcpy(copy, name.data(), name.size());
+        entry(count) = std::string_view(copy, name.size());
+        return count++;
+    }
+
+    void rehash() {
+        std::vector<Slot> old = std::move(slots);
+        slots.assign(old.empty() ? 64 : old.size() * 2, Slot{0, 0});
+        std::size_t mask = slots.size() - 1;
+        for (Slot s : old) {
+            if (!s.index)
+                continue;
+            std::size_t h = std::hash<std::string_view>()(entry(s.index - 1));
+            std::size_t i = h & mask;
+            while (slots[i].index)
+                i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+};
+
+SymbolTable::SymbolTable() : shards(new Shard[shard_count]) {}
+
+SymbolTable::~SymbolTable() = default;
+
+Symbol SymbolTable::intern(std::string_view name) {
+    std::size_t h = std::hash<std::string_view>()(name);
+    std::size_t shard_no = h >> (64 - shard_bits);
+    uint32_t tag = uint32_t(h >> 32);
+    Shard& shard = shards[shard_no];
+
+    std::lock_guard<std::mutex> lock(shard.mu);
+    if ((shard.count + 1) * 2 > shard.slots.size())
+        shard.rehash();
+    std::size_t mask = shard.slots.size() - 1;
+    std::size_t i = h & mask;
+    for (; shard.slots[i].index; i = (i + 1) & mask) {
+        const Slot& s = shard.slots[i];
+        if (s.tag == tag && shard.entry(s.index - 1) == name)
+            return (s.index - 1) << shard_bits | shard_no;
+    }
+    uint32_t index = shard.append(name);
+    shard.slots[i] = Slot{tag, index + 1};
+    return index << shard_bits | shard_no;
+}
+
+std::string_view SymbolTable::spelling(Symbol sym) const {
+    return shards[sym & (shard_count - 1)].entry(sym >> shard_bits);
+}
+
+std::size_t SymbolTable::size() const {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < shard_count; i++) {
+        std::lock_guard<std::mutex> lock(shards[i].mu);
+        n += shards[i].count;
+    }
+    return n;
+}
+
+std::size_t SymbolTable::memory_usage() const {
+    std::size_t n = shard_count * sizeof(Shard);
+    for (std::size_t i = 0; i < shard_count; i++) {
+        Shard& shard = shards[i];
+        std::lock_guard<std::mutex> lock(shard.mu);
+        n += shard.slots.capacity() * sizeof(Slot) + shard.pool.bytes_reserved();
+        for (unsigned c = 0; c < chunk_count; c++)
+            if (shard.chunks[c].load(std::memory_order_relaxed))
+                n += (first_chunk << c) * sizeof(std::string_view);
+    }
+    return n;
+}
+
+SymbolTable& SymbolTable::global() {
+    static SymbolTable table;
+    return table;
+}
@@ -0,0 +1,39 @@
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+// An interned identifier. Two identifiers have the same Symbol exactly when
+// they are spelled the same, so names compare as integers.
+using Symbol = uint32_t;
+
+// Maps every distinct spelling to a Symbol and stores the spelling once.
+// Interning may happen from any number of threads at the same time: the
+// table is split into independently locked shards, and looking up the
+// spelling of a Symbol takes no lock at all. Symbols and spellings stay
+// valid for the life of the table.
+class SymbolTable {
+    struct Shard;
+    std::unique_ptr<Shard[]> shards;
+public:
+    SymbolTable();
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+    ~SymbolTable();
+
+    Symbol intern(std::string_view name);
+    // `sym` must have come from intern() on this table.
+    std::string_view spelling(Symbol sym) const;
+
+    // Number of distinct symbols, and bytes held by the table.
+    std::size_t size() const;
+    std::size_t memory_usage() const;
+
+    // The table shared by every tree in the process.
+    static SymbolTable& global();
+};
+
+#endif
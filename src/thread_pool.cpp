@@ -0,0 +1,101 @@
+#include "thread_pool.hpp"
+#include <utility>
+
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    for (unsigned i = 0; i < threads; i++)
+        queues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < threads; i++)
+        workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (std::thread& t : workers)
+        t.join();
+}
+
+bool ThreadPool::take(std::size_t id, std::size_t& index) {
+    {
+        Queue& own = *queues[id];
+        std::lock_guard<std::mutex> lock(own.mu);
+        if (!own.jobs.empty()) {
+            index = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+    for (std::size_t k = 1; k < queues.size(); k++) {
+        Queue& victim = *queues[(id + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mu);
+        if (!victim.jobs.empty()) {
+            index = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(std::size_t id) {
+    std::size_t seen = 0;
+    std::unique_lock<std::mutex> lock(mu);
+    for (;;) {
+        start_cv.wait(lock, [&] { return stopping || (job && batch != seen); });
+        if (stopping)
+            return;
+        seen = batch;
+        const std::function<void(std::size_t)>* fn = job;
+        active++;
+        lock.unlock();
+
+        std::size_t index;
+        while (take(id, index)) {
+            std::exception_ptr err;
+            try {
+                (*fn)(index);
+            } catch (...) {
+                err = std::current_exception();
+            }
+            std::lock_guard<std::mutex> done(mu);
+            if (err && !failure)
+                failure = err;
+            remaining--;
+        }
+
+        lock.lock();
+        if (--active == 0 && remaining == 0)
+            done_cv.notify_all();
+    }
+}
+
+void ThreadPool::run(std::size_t count, const std::function<void(std::size_t)>& fn) {
+    if (count == 0)
+        return;
+
+    // No worker is active between batches, so the queues can be filled
+    // without racing against stragglers of the previous batch.
+    std::unique_lock<std::mutex> lock(mu);
+    for (std::size_t i = 0; i < count; i++) {
+        Queue& q = *queues[i % queues.size()];
+        std::lock_guard<std::mutex> qlock(q.mu);
+        q.jobs.push_back(i);
+    }
+    job = &fn;
+    remaining = count;
+    failure = nullptr;
+    batch++;
+    start_cv.notify_all();
+    done_cv.wait(lock, [&] { return remaining == 0 && active == 0; });
+    job = nullptr;
+    if (failure)
+        std::rethrow_exception(std::exchange(failure, nullptr));
+}
@@ -0,0 +1,57 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run batches of indexed jobs.
+//
+// run() deals the job indices out to per-worker queues round-robin. A worker
+// takes jobs from the front of its own queue and, once that is empty, steals
+// from the back of the others'. Callers that know how expensive their jobs
+// are should order them most expensive first: every worker then starts on
+// the largest job it has and thieves pick up the cheap leftovers.
+class ThreadPool {
+    struct Queue {
+        std::mutex mu;
+        std::deque<std::size_t> jobs;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues; // one per worker
+
+    std::mutex mu; // guards everything below
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    const std::function<void(std::size_t)>* job = nullptr;
+    std::size_t batch = 0;     // bumped for every run()
+    std::size_t remaining = 0; // jobs of the current batch not yet finished
+    std::size_t active = 0;    // workers taking jobs of the current batch
+    std::exception_ptr failure;
+    bool stopping = false;
+
+    void work(std::size_t id);
+    bool take(std::size_t id, std::size_t& index);
+public:
+    // 0 threads means one per hardware thread.
+    explicit ThreadPool(unsigned threads = 0);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    std::size_t size() const { return workers.size(); }
+
+    // Calls fn(i) for every i in [0, count) on the workers and waits until
+    // all calls have returned. If any of them throws, the first exception is
+    // rethrown here once the batch is done. Not reentrant.
+    void run(std::size_t count, const std::function<void(std::size_t)>& fn);
+};
+
+#endif
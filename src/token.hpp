@@ -1,8 +1,11 @@
 #ifndef TOKEN_HPP
 #define TOKEN_HPP
 
+#include <array>
+#include <cstdint>
 #include <ostream>
-#include <map>
+#include <string_view>
+#include <iterator>
 
 
 
@@ -67,7 +70,132 @@ enum class Token {
     _end_keywords,
 };
 
-extern std::map<Token, std::string> token_string;
+enum class TokenCategory : uint8_t {
+    SPECIAL,  // ENDMARKER, NEWLINE, UNKNOWN
+    LITERAL,
+    OPERATOR,
+    KEYWORD,
+    MARKER,   // the _beg_/_end_ range markers, never produced by the Lexer
+};
+
+enum class TokenAssoc : uint8_t {
+    LEFT,  // a - b - c is (a - b) - c
+    RIGHT, // a = b = c is a = (b = c)
+};
+
+struct TokenInfo {
+    Token tok;
+    std::string_view spelling;
+    TokenCategory category;
+    // Binding strength as a binary operator, higher binds tighter;
+    // 0 if the token is not a binary operator.
+    int8_t precedence;
+    // How operators of the same precedence group.
+    TokenAssoc assoc = TokenAssoc::LEFT;
+    // Whether the token is also a prefix operator, which binds tighter
+    // than any binary one.
+    bool prefix = false;
+};
+
+// Everything known about each Token, indexed by its value.
+inline constexpr TokenInfo token_table[] = {
+    {Token::ENDMARKER, "ENDMARKER", TokenCategory::SPECIAL, 0},
+    {Token::NEWLINE, "NEWLINE", TokenCategory::SPECIAL, 0},
+    {Token::UNKNOWN, "UNKNOWN", TokenCategory::SPECIAL, 0},
+
+    {Token::_beg_literals, "_beg_literals", TokenCategory::MARKER, 0},
+    {Token::IDENT, "IDENT", TokenCategory::LITERAL, 0},
+    {Token::STRING, "STRING", TokenCategory::LITERAL, 0},
+    {Token::INT, "INT", TokenCategory::LITERAL, 0},
+    {Token::FLOAT, "FLOAT", TokenCategory::LITERAL, 0},
+    {Token::_end_literals, "_end_literals", TokenCategory::MARKER, 0},
+
+    {Token::_beg_operators, "_beg_operators", TokenCategory::MARKER, 0},
+    {Token::ASSIGN, "=", TokenCategory::OPERATOR, 0},
+    {Token::ADD, "+", TokenCategory::OPERATOR, 4, TokenAssoc::LEFT, true},
+    {Token::SUB, "-", TokenCategory::OPERATOR, 4, TokenAssoc::LEFT, true},
+    {Token::MUL, "*", TokenCategory::OPERATOR, 5},
+    {Token::DIV, "/", TokenCategory::OPERATOR, 5},
+    {Token::REM, "%", TokenCategory::OPERATOR, 0},
+    {Token::NOT, "!", TokenCategory::OPERATOR, 0, TokenAssoc::LEFT, true},
+    {Token::EQUAL, "==", TokenCategory::OPERATOR, 3},
+    {Token::NOTEQ, "!=", TokenCategory::OPERATOR, 3},
+    {Token::GREATER, ">", TokenCategory::OPERATOR, 3},
+    {Token::LESS, "<", TokenCategory::OPERATOR, 3},
+    {Token::LESSEQ, "<=", TokenCategory::OPERATOR, 3},
+    {Token::GREATEREQ, ">=", TokenCategory::OPERATOR, 3},
+    {Token::AND, "&&", TokenCategory::OPERATOR, 2},
+    {Token::OR, "||", TokenCategory::OPERATOR, 1},
+    {Token::COMMA, ",", TokenCategory::OPERATOR, 0},
+    {Token::COLON, ":", TokenCategory::OPERATOR, 0},
+    {Token::DOT, ".", TokenCategory::OPERATOR, 0},
+    {Token::LBRACE, "{", TokenCategory::OPERATOR, 0},
+    {Token::RBRACE, "}", TokenCategory::OPERATOR, 0},
+    {Token::LBRACKET, "[", TokenCategory::OPERATOR, 0},
+    {Token::RBRACKET, "]", TokenCategory::OPERATOR, 0},
+    {Token::LPAREN, "(", TokenCategory::OPERATOR, 0},
+    {Token::RPAREN, ")", TokenCategory::OPERATOR, 0},
+    {Token::_end_operators, "_end_operators", TokenCategory::MARKER, 0},
+
+    {Token::_beg_keywords, "_beg_keywords", TokenCategory::MARKER, 0},
+    {Token::LET, "let", TokenCategory::KEYWORD, 0},
+    {Token::IF, "if", TokenCategory::KEYWORD, 0},
+    {Token::IN, "in", TokenCategory::KEYWORD, 0},
+    {Token::ELSE, "else", TokenCategory::KEYWORD, 0},
+    {Token::TRUE, "true", TokenCategory::KEYWORD, 0},
+    {Token::FALSE, "false", TokenCategory::KEYWORD, 0},
+    {Token::FUN, "fun", TokenCategory::KEYWORD, 0},
+    {Token::RETURN, "return", TokenCategory::KEYWORD, 0},
+    {Token::FOR, "for", TokenCategory::KEYWORD, 0},
+    {Token::WHILE, "while", TokenCategory::KEYWORD, 0},
+    {Token::BREAK, "break", TokenCategory::KEYWORD, 0},
+    {Token::CONTINUE, "continue", TokenCategory::KEYWORD, 0},
+    {Token::_end_keywords, "_end_keywords", TokenCategory::MARKER, 0},
+};
+
+static_assert([] {
+    for (std::size_t i = 0; i < std::size(token_table); i++)
+        if (token_table[i].tok != Token(i))
+            return false;
+    return std::size(token_table) == std::size_t(Token::_end_keywords) + 1;
+}(), "token_table must have one row per Token, in enum order");
+
+inline constexpr const TokenInfo& token_info(Token tok) {
+    return token_table[std::size_t(tok)];
+}
+
+inline constexpr std::string_view token_spelling(Token tok) {
+    return token_info(tok).spelling;
+}
+
+inline constexpr int token_precedence(Token tok) {
+    return token_info(tok).precedence;
+}
+
+inline constexpr TokenAssoc token_assoc(Token tok) {
+    return token_info(tok).assoc;
+}
+
+inline constexpr bool token_is_prefix(Token tok) {
+    return token_info(tok).prefix;
+}
+
+inline constexpr std::size_t keyword_count =
+    std::size_t(Token::_end_keywords) - std::size_t(Token::_beg_keywords) - 1;
+
+inline constexpr Token keyword_token(std::size_t i) {
+    return Token(int(Token::_beg_keywords) + 1 + int(i));
+}
+
+// Spellings of the keywords, in the order they appear in Token.
+// The Lexer builds its keyword table from this at compile time.
+inline constexpr auto keyword_spelling = [] {
+    std::array<std::string_view, keyword_count> a{};
+    for (std::size_t i = 0; i < keyword_count; i++)
+        a[i] = token_spelling(keyword_token(i));
+    return a;
+}();
+
 std::ostream& operator<<(std::ostream& os, Token tok);
 
 #endif
@@ -0,0 +1,176 @@
+#ifndef VISITOR_HPP
+#define VISITOR_HPP
+
+#include <vector>
+#include "ast.hpp"
+#include "flat_ast.hpp"
+
+// Passes over the AST dispatch on NodeType with a switch that the compiler
+// can inline, instead of a virtual call per node. Visitor suits passes that
+// compute a value per node and recurse themselves; Walker suits passes
+// that only need to see the nodes in order, however deep the tree.
+namespace AST {
+
+    // The view of a tree a Walker needs. PointerAccess reads the tree of
+    // ast.hpp, FlatAccess a Flat::Tree; both also expose the node contents
+    // so that one pass can serve either tree.
+    struct PointerAccess {
+        using Handle = Node*;
+
+        NodeType type(Handle n) const { return n->type(); }
+        std::size_t pos(Handle n) const { return n->pos(); }
+
+        std::size_t children(Handle n) const {
+            switch (n->type()) {
+                case NODE_PROGRAM: return static_cast<Program*>(n)->stmts.size();
+                case STMT_EXPR:
+                case EXPR_UNARY: return 1;
+                case EXPR_BINARY: return 2;
+                default: return 0;
+            }
+        }
+        Handle child(Handle n, std::size_t i) const {
+            switch (n->type()) {
+                case NODE_PROGRAM: return static_cast<Program*>(n)->stmts[i];
+                case STMT_EXPR: return static_cast<StmtExpr*>(n)->expr;
+                case EXPR_UNARY: return static_cast<ExprUnary*>(n)->right;
+                case EXPR_BINARY: {
+                    auto* x = static_cast<ExprBinary*>(n);
+                    return i == 0 ? x->left : x->right;
+                }
+                default: return nullptr;
+            }
+        }
+
+        Token op(Handle n) const {
+            return n->type() == EXPR_UNARY ? static_cast<ExprUnary*>(n)->op
+                                           : static_cast<ExprBinary*>(n)->op;
+        }
+        int64_t int_value(Handle n) const { return static_cast<IntLit*>(n)->value; }
+        double float_value(Handle n) const { return static_cast<FloatLit*>(n)->value; }
+        Symbol symbol(Handle n) const { return static_cast<IdentLit*>(n)->name; }
+        std::string_view spelling(Handle n) const {
+            return n->type() == EXPR_LIT_IDENT ? static_cast<IdentLit*>(n)->spelling()
+                                               : static_cast<StringLit*>(n)->value;
+        }
+    };
+
+    struct FlatAccess {
+        using Handle = Flat::Ref;
+        const Flat::Tree* tree;
+
+        explicit FlatAccess(const Flat::Tree& tree) : tree(&tree) {}
+
+        NodeType type(Handle n) const { return tree->type(n); }
+        std::size_t pos(Handle n) const { return tree->pos[n]; }
+
+        std::size_t children(Handle n) const {
+            switch (tree->type(n)) {
+                case STMT_EXPR:
+                case EXPR_UNARY: return 1;
+                case EXPR_BINARY: return 2;
+                default: return 0;
+            }
+        }
+        Handle child(Handle n, std::size_t i) const {
+            switch (tree->type(n)) {
+                case STMT_EXPR: return tree->lhs(n);
+                case EXPR_UNARY: return tree->rhs(n);
+                case EXPR_BINARY: return i == 0 ? tree->lhs(n) : tree->rhs(n);
+                default: return Flat::none;
+            }
+        }
+
+        Token op(Handle n) const { return tree->op(n); }
+        int64_t int_value(Handle n) const { return tree->int_value(n); }
+        double float_value(Handle n) const { return tree->float_value(n); }
+        Symbol symbol(Handle n) const { return tree->symbol(n); }
+        std::string_view spelling(Handle n) const { return tree->spelling(n); }
+    };
+
+    // Calls Derived::visit_<kind> for the concrete type of a node and
+    // returns its result. Anything Derived leaves out goes to
+    // visit_node(), which by default returns R().
+    template <class Derived, class R = void>
+    class Visitor {
+        Derived& self() { return static_cast<Derived&>(*this); }
+    public:
+        R visit(Node* n) {
+            switch (n->type()) {
+                case NODE_PROGRAM: return self().visit_program(static_cast<Program*>(n));
+                case STMT_EXPR: return self().visit_stmt_expr(static_cast<StmtExpr*>(n));
+                case EXPR_LIT_STRING: return self().visit_string(static_cast<StringLit*>(n));
+                case EXPR_LIT_INT: return self().visit_int(static_cast<IntLit*>(n));
+                case EXPR_LIT_FLOAT: return self().visit_float(static_cast<FloatLit*>(n));
+                case EXPR_LIT_IDENT: return self().visit_ident(static_cast<IdentLit*>(n));
+                case EXPR_UNARY: return self().visit_unary(static_cast<ExprUnary*>(n));
+                case EXPR_BINARY: return self().visit_binary(static_cast<ExprBinary*>(n));
+                case EXPR_BAD: return self().visit_bad(static_cast<ExprBad*>(n));
+                default: return self().visit_node(n);
+            }
+        }
+
+        R visit_node(Node*) { return R(); }
+        R visit_program(Program* n) { return self().visit_node(n); }
+        R visit_stmt_expr(StmtExpr* n) { return self().visit_node(n); }
+        R visit_string(StringLit* n) { return self().visit_node(n); }
+        R visit_int(IntLit* n) { return self().visit_node(n); }
+        R visit_float(FloatLit* n) { return self().visit_node(n); }
+        R visit_ident(IdentLit* n) { return self().visit_node(n); }
+        R visit_unary(ExprUnary* n) { return self().visit_node(n); }
+        R visit_binary(ExprBinary* n) { return self().visit_node(n); }
+        R visit_bad(ExprBad* n) { return self().visit_node(n); }
+    };
+
+    // Depth-first traversal on an explicit stack, so its native stack use
+    // does not depend on the depth of the tree. Derived may provide:
+    //   bool pre(Handle)                 before the children; false skips
+    //                                    them and post()
+    //   void between(Handle, size_t i)   before child i, for i > 0
+    //   void post(Handle)                after the children
+    template <class Derived, class Access = PointerAccess>
+    class Walker {
+    public:
+        using Handle = typename Access::Handle;
+    private:
+        struct Frame {
+            Handle node;
+            std::size_t next; // child to visit next
+        };
+        std::vector<Frame> stack; // kept between walks for its capacity
+
+        Derived& self() { return static_cast<Derived&>(*this); }
+    protected:
+        Access access;
+    public:
+        explicit Walker(Access access = Access()) : access(access) {}
+
+        bool pre(Handle) { return true; }
+        void between(Handle, std::size_t) {}
+        void post(Handle) {}
+
+        void walk(Handle root) {
+            if (!self().pre(root))
+                return;
+            stack.push_back({root, 0});
+            while (!stack.empty()) {
+                Frame& top = stack.back();
+                Handle n = top.node;
+                std::size_t i = top.next;
+                if (i == access.children(n)) {
+                    stack.pop_back();
+                    self().post(n);
+                    continue;
+                }
+                top.next++;
+                if (i > 0)
+                    self().between(n, i);
+                Handle c = access.child(n, i);
+                if (self().pre(c))
+                    stack.push_back({c, 0});
+            }
+        }
+    };
+}
+
+#endif
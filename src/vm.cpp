@@ -0,0 +1,441 @@
+#include "vm.hpp"
+#include "fold.hpp"
+#include "visitor.hpp"
+#include <algorithm>
+#include <limits>
+
+using namespace AST;
+using vm::Chunk;
+using vm::Instr;
+using vm::Reg;
+using vm::Value;
+
+
+/*
+ * Compiler
+ */
+
+// Emits code on a post-order walk. The operand stack mirrors the register
+// file: the value at depth d of the stack lives in register d, so an
+// operator reads its operands from the top two registers and leaves its
+// result in the lower one.
+class Compiler : public Walker<Compiler> {
+    struct Operand {
+        uint16_t reg;
+        Value::Kind kind;
+    };
+
+    Chunk& chunk;
+    std::string& err;
+    std::vector<Operand> stack;
+    std::vector<std::size_t> jumps; // of && and ||, waiting for their target
+    std::vector<uint32_t> slots; // by Symbol; none if the name has no slot yet
+    static constexpr uint32_t none = UINT32_MAX;
+
+    void fail(std::string msg) {
+        if (err.empty())
+            err = std::move(msg);
+    }
+
+    void emit(vm::Op op, uint16_t a, uint16_t b = 0, uint16_t c = 0) {
+        chunk.code.push_back(Instr{op, a, b, c});
+    }
+    void emit_bc(vm::Op op, uint16_t a, uint32_t bc) {
+        emit(op, a, bc >> 16, bc & 0xFFFF);
+    }
+
+    bool push(Value::Kind kind) {
+        if (stack.size() > std::numeric_limits<uint16_t>::max()) {
+            fail("expression too deeply nested");
+            return false;
+        }
+        stack.push_back({uint16_t(stack.size()), kind});
+        chunk.regs = std::max(chunk.regs, stack.size());
+        return true;
+    }
+
+    void load_const(Reg value, Value::Kind kind) {
+        if (!push(kind))
+            return;
+        emit_bc(vm::LOADK, stack.back().reg, chunk.consts.size());
+        chunk.consts.push_back(value);
+    }
+
+    void to_float(Operand& x) {
+        if (x.kind == Value::INT) {
+            emit(vm::I2F, x.reg, x.reg);
+            x.kind = Value::FLOAT;
+        }
+    }
+
+    void truth(Operand& dst, Operand src) {
+        emit(src.kind == Value::INT ? vm::TRUTH_I : vm::TRUTH_F, dst.reg, src.reg);
+        dst.kind = Value::INT;
+    }
+
+    static vm::Op binary_op(Token op, bool f) {
+        switch (op) {
+            case Token::ADD:       return f ? vm::ADD_F : vm::ADD_I;
+            case Token::SUB:       return f ? vm::SUB_F : vm::SUB_I;
+            case Token::MUL:       return f ? vm::MUL_F : vm::MUL_I;
+            case Token::DIV:       return f ? vm::DIV_F : vm::DIV_I;
+            case Token::EQUAL:     return f ? vm::EQ_F : vm::EQ_I;
+            case Token::NOTEQ:     return f ? vm::NE_F : vm::NE_I;
+            case Token::LESS:      return f ? vm::LT_F : vm::LT_I;
+            case Token::GREATER:   return f ? vm::GT_F : vm::GT_I;
+            case Token::LESSEQ:    return f ? vm::LE_F : vm::LE_I;
+            default:               return f ? vm::GE_F : vm::GE_I;
+        }
+    }
+
+    static bool is_comparison(Token op) {
+        return op == Token::EQUAL || op == Token::NOTEQ || op == Token::LESS ||
+            op == Token::GREATER || op == Token::LESSEQ || op == Token::GREATEREQ;
+    }
+public:
+    Compiler(Chunk& chunk, std::string& err) : chunk(chunk), err(err) {}
+
+    bool pre(Node* n) {
+        if (!err.empty())
+            return false;
+        switch (n->type()) {
+            case EXPR_LIT_INT: {
+                Reg r;
+                r.i = static_cast<IntLit*>(n)->value;
+                load_const(r, Value::INT);
+                return false;
+            }
+            case EXPR_LIT_FLOAT: {
+                Reg r;
+                r.f = static_cast<FloatLit*>(n)->value;
+                load_const(r, Value::FLOAT);
+                return false;
+            }
+            case EXPR_LIT_IDENT: {
+                Symbol name = static_cast<IdentLit*>(n)->name;
+                if (name >= slots.size())
+                    slots.resize(std::max<std::size_t>(name + 1, slots.size() * 2), none);
+                if (slots[name] == none) {
+                    slots[name] = chunk.globals.size();
+                    chunk.globals.push_back(name);
+                }
+                if (push(Value::INT))
+                    emit_bc(vm::LOADG, stack.back().reg, slots[name]);
+                return false;
+            }
+            case EXPR_LIT_STRING:
+                fail("strings are not supported");
+                return false;
+            case EXPR_BAD:
+                fail("program has errors");
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    void between(Node* n, std::size_t) {
+        if (!err.empty() || n->type() != EXPR_BINARY)
+            return;
+        Token op = static_cast<ExprBinary*>(n)->op;
+        if (op != Token::AND && op != Token::OR)
+            return;
+        // The left operand decides alone if it is false for && or true for ||.
+        Operand& left = stack.back();
+        truth(left, left);
+        jumps.push_back(chunk.code.size());
+        emit(op == Token::AND ? vm::JZ : vm::JNZ, left.reg);
+    }
+
+    void post(Node* n) {
+        if (!err.empty())
+            return;
+        switch (n->type()) {
+            case EXPR_UNARY: {
+                Operand& x = stack.back();
+                switch (static_cast<ExprUnary*>(n)->op) {
+                    case Token::SUB:
+                        emit(x.kind == Value::INT ? vm::NEG_I : vm::NEG_F, x.reg, x.reg);
+                        break;
+                    case Token::NOT:
+                        emit(x.kind == Value::INT ? vm::NOT_I : vm::NOT_F, x.reg, x.reg);
+                        x.kind = Value::INT;
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            }
+            case EXPR_BINARY: {
+                Token op = static_cast<ExprBinary*>(n)->op;
+                Operand right = stack.back();
+                stack.pop_back();
+                Operand& left = stack.back();
+                if (op == Token::AND || op == Token::OR) {
+                    truth(left, right);
+                    std::size_t at = jumps.back();
+                    jumps.pop_back();
+                    uint32_t target = chunk.code.size();
+                    chunk.code[at].b = target >> 16;
+                    chunk.code[at].c = target & 0xFFFF;
+                    break;
+                }
+                bool f = left.kind == Value::FLOAT || right.kind == Value::FLOAT;
+                if (f) {
+                    to_float(left);
+                    to_float(right);
+                }
+                emit(binary_op(op, f), left.reg, left.reg, right.reg);
+                if (is_comparison(op))
+                    left.kind = Value::INT;
+                break;
+            }
+            case STMT_EXPR: {
+                Operand x = stack.back();
+                stack.pop_back();
+                emit(x.kind == Value::INT ? vm::RESULT_I : vm::RESULT_F, x.reg);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+};
+
+bool vm::compile(Program* prog, Chunk& chunk, std::string& err) {
+    chunk = Chunk();
+    err.clear();
+    Compiler(chunk, err).walk(prog);
+    chunk.code.push_back(Instr{HALT, 0, 0, 0});
+    return err.empty();
+}
+
+
+/*
+ * Machine
+ */
+
+int64_t vm::Machine::global(Symbol name) const {
+    auto it = values.find(name);
+    return it == values.end() ? 0 : it->second;
+}
+
+// Threaded dispatch: every handler jumps straight to the next one through
+// a table of label addresses (a GNU extension), which gives the branch
+// predictor one indirect jump per opcode instead of one shared one.
+#if defined(__GNUC__)
+#define VM_THREADED 1
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+bool vm::Machine::run(const Chunk& chunk, Value& result, std::string& err) {
+    regs.resize(chunk.regs);
+    frame.resize(chunk.globals.size());
+    for (std::size_t i = 0; i < frame.size(); i++)
+        frame[i] = global(chunk.globals[i]);
+
+    Reg* r = regs.data();
+    const Reg* k = chunk.consts.data();
+    const int64_t* g = frame.data();
+    const Instr* pc = chunk.code.data();
+    result = Value();
+
+#define A r[pc->a]
+#define B r[pc->b]
+#define C r[pc->c]
+#define BC ((uint32_t(pc->b) << 16) | pc->c)
+
+#ifdef VM_THREADED
+    static void* const labels[] = {
+#define VM_OP_LABEL(name) &&op_##name,
+        VM_OPS(VM_OP_LABEL)
+#undef VM_OP_LABEL
+    };
+#define DISPATCH() goto *labels[pc->op]
+#define CASE(name) op_##name:
+#define NEXT() do { pc++; DISPATCH(); } while (0)
+    DISPATCH();
+#else
+#define CASE(name) case name:
+#define NEXT() do { pc++; goto next; } while (0)
+next:
+    switch (pc->op) {
+#endif
+
+    CASE(LOADK) A = k[BC]; NEXT();
+    CASE(LOADG) A.i = g[BC]; NEXT();
+    CASE(I2F) A.f = double(B.i); NEXT();
+
+    CASE(NEG_I)
+        if (B.i == INT64_MIN)
+            goto overflow;
+        A.i = -B.i;
+        NEXT();
+    CASE(NEG_F) A.f = -B.f; NEXT();
+    CASE(NOT_I) A.i = B.i == 0; NEXT();
+    CASE(NOT_F) A.i = B.f == 0; NEXT();
+    CASE(TRUTH_I) A.i = B.i != 0; NEXT();
+    CASE(TRUTH_F) A.i = B.f != 0; NEXT();
+
+    CASE(ADD_I) if (__builtin_add_overflow(B.i, C.i, &A.i)) goto overflow; NEXT();
+    CASE(SUB_I) if (__builtin_sub_overflow(B.i, C.i, &A.i)) goto overflow; NEXT();
+    CASE(MUL_I) if (__builtin_mul_overflow(B.i, C.i, &A.i)) goto overflow; NEXT();
+    CASE(DIV_I)
+        if (C.i == 0)
+            goto div_by_zero;
+        if (B.i == INT64_MIN && C.i == -1)
+            goto overflow;
+        A.i = B.i / C.i;
+        NEXT();
+    CASE(ADD_F) A.f = B.f + C.f; NEXT();
+    CASE(SUB_F) A.f = B.f - C.f; NEXT();
+    CASE(MUL_F) A.f = B.f * C.f; NEXT();
+    CASE(DIV_F)
+        if (C.f == 0)
+            goto div_by_zero;
+        A.f = B.f / C.f;
+        NEXT();
+
+    CASE(EQ_I) A.i = B.i == C.i; NEXT();
+    CASE(NE_I) A.i = B.i != C.i; NEXT();
+    CASE(LT_I) A.i = B.i < C.i; NEXT();
+    CASE(GT_I) A.i = B.i > C.i; NEXT();
+    CASE(LE_I) A.i = B.i <= C.i; NEXT();
+    CASE(GE_I) A.i = B.i >= C.i; NEXT();
+    CASE(EQ_F) A.i = B.f == C.f; NEXT();
+    CASE(NE_F) A.i = B.f != C.f; NEXT();
+    CASE(LT_F) A.i = B.f < C.f; NEXT();
+    CASE(GT_F) A.i = B.f > C.f; NEXT();
+    CASE(LE_F) A.i = B.f <= C.f; NEXT();
+    CASE(GE_F) A.i = B.f >= C.f; NEXT();
+
+    CASE(JZ)
+        if (A.i == 0) {
+            pc = chunk.code.data() + BC;
+#ifdef VM_THREADED
+            DISPATCH();
+#else
+            goto next;
+#endif
+        }
+        NEXT();
+    CASE(JNZ)
+        if (A.i != 0) {
+            pc = chunk.code.data() + BC;
+#ifdef VM_THREADED
+            DISPATCH();
+#else
+            goto next;
+#endif
+        }
+        NEXT();
+
+    CASE(RESULT_I) result.kind = Value::INT; result.v = A; NEXT();
+    CASE(RESULT_F) result.kind = Value::FLOAT; result.v = A; NEXT();
+    CASE(HALT) return true;
+
+#ifndef VM_THREADED
+    }
+#endif
+
+overflow:
+    err = "integer overflow";
+    return false;
+div_by_zero:
+    err = "division by zero";
+    return false;
+
+#undef A
+#undef B
+#undef C
+#undef BC
+#undef CASE
+#undef NEXT
+#undef DISPATCH
+}
+
+#ifdef VM_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+
+/*
+ * Tree-walking evaluator
+ */
+
+// The straightforward evaluator: recursion on the tree, a name lookup per
+// identifier and a kind test per operation.
+class Evaluator : public Visitor<Evaluator, fold::Const> {
+    vm::Machine& m;
+public:
+    std::string err;
+
+    explicit Evaluator(vm::Machine& m) : m(m) {}
+
+    fold::Const fail(fold::Status st) {
+        if (err.empty())
+            err = st == fold::Status::DIV_BY_ZERO ? "division by zero" : "integer overflow";
+        return fold::Const::of_int(0);
+    }
+
+    fold::Const visit_node(Node*) {
+        if (err.empty())
+            err = "strings are not supported";
+        return fold::Const::of_int(0);
+    }
+    fold::Const visit_bad(ExprBad*) {
+        if (err.empty())
+            err = "program has errors";
+        return fold::Const::of_int(0);
+    }
+    fold::Const visit_int(IntLit* n) { return fold::Const::of_int(n->value); }
+    fold::Const visit_float(FloatLit* n) { return fold::Const::of_float(n->value); }
+    fold::Const visit_ident(IdentLit* n) { return fold::Const::of_int(m.global(n->name)); }
+
+    fold::Const visit_unary(ExprUnary* n) {
+        fold::Const x = visit(n->right), out;
+        fold::Status st = fold::unary(n->op, x, out);
+        return st == fold::Status::OK ? out : fail(st);
+    }
+
+    fold::Const visit_binary(ExprBinary* n) {
+        fold::Const l = visit(n->left), out;
+        if (!err.empty())
+            return l;
+        if (n->op == Token::AND || n->op == Token::OR) {
+            bool lt = l.kind == fold::Const::INT ? l.i != 0 : l.f != 0;
+            if (lt == (n->op == Token::OR))
+                return fold::Const::of_int(lt);
+        }
+        fold::Const r = visit(n->right);
+        fold::Status st = fold::binary(n->op, l, r, out);
+        return st == fold::Status::OK ? out : fail(st);
+    }
+};
+
+bool vm::Machine::eval_tree(Program* prog, Value& result, std::string& err) {
+    Evaluator ev(*this);
+    result = Value();
+    for (Stmt* stmt : prog->stmts) {
+        fold::Const c = ev.visit(static_cast<StmtExpr*>(stmt)->expr);
+        if (!ev.err.empty()) {
+            err = ev.err;
+            return false;
+        }
+        result.kind = c.kind == fold::Const::INT ? Value::INT : Value::FLOAT;
+        if (c.kind == fold::Const::INT)
+            result.v.i = c.i;
+        else
+            result.v.f = c.f;
+    }
+    return true;
+}
+
+std::string vm::to_string(Value v) {
+    switch (v.kind) {
+        case Value::INT: return std::to_string(v.v.i);
+        case Value::FLOAT: return std::to_string(v.v.f);
+        default: return "";
+    }
+}
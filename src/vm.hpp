@@ -0,0 +1,86 @@
+#ifndef VM_HPP
+#define VM_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.hpp"
+
+// Runs Panda programs without going through C. A Program is compiled to
+// bytecode for a register machine: every value is an unboxed int64 or
+// double, and since Panda names hold ints (as in the C backend) the kind of
+// every register is known when compiling, so instructions come in int and
+// float forms and never test a tag at run time. Arithmetic, division by
+// zero and overflow behave as in constant folding (see fold.hpp).
+namespace vm {
+
+    union Reg {
+        int64_t i;
+        double f;
+    };
+
+    struct Value {
+        enum Kind { NONE, INT, FLOAT } kind = NONE;
+        Reg v{};
+    };
+
+#define VM_OPS(X) \
+    X(LOADK)   /* a = consts[bc] */                     \
+    X(LOADG)   /* a = globals[bc] */                    \
+    X(I2F)     /* a = double(b) */                      \
+    X(NEG_I) X(NEG_F)                                   \
+    X(NOT_I) X(NOT_F)     /* a = !b, an int */          \
+    X(TRUTH_I) X(TRUTH_F) /* a = b != 0, an int */      \
+    X(ADD_I) X(SUB_I) X(MUL_I) X(DIV_I)                 \
+    X(ADD_F) X(SUB_F) X(MUL_F) X(DIV_F)                 \
+    X(EQ_I) X(NE_I) X(LT_I) X(GT_I) X(LE_I) X(GE_I)     \
+    X(EQ_F) X(NE_F) X(LT_F) X(GT_F) X(LE_F) X(GE_F)     \
+    X(JZ)      /* if a == 0, go to bc */                \
+    X(JNZ)     /* if a != 0, go to bc */                \
+    X(RESULT_I) X(RESULT_F) /* the statement's value is a */ \
+    X(HALT)
+
+    enum Op : uint8_t {
+#define VM_OP_ENUM(name) name,
+        VM_OPS(VM_OP_ENUM)
+#undef VM_OP_ENUM
+    };
+
+    // Operands a, b, c are registers; "bc" is b and c read as one 32-bit
+    // index, high half in b.
+    struct Instr {
+        Op op;
+        uint16_t a, b, c;
+    };
+
+    struct Chunk {
+        std::vector<Instr> code;
+        std::vector<Reg> consts;
+        std::vector<Symbol> globals; // the name behind each global slot
+        std::size_t regs = 0;
+    };
+
+    // Returns false and sets `err` for programs the VM can't run: ones with
+    // strings or syntax errors in them, or too deeply nested.
+    bool compile(AST::Program* prog, Chunk& chunk, std::string& err);
+
+    class Machine {
+        std::unordered_map<Symbol, int64_t> values; // names not set here are 0
+        std::vector<Reg> regs;
+        std::vector<int64_t> frame;
+    public:
+        void set_global(Symbol name, int64_t value) { values[name] = value; }
+        int64_t global(Symbol name) const;
+
+        // Runs every statement; `result` is the value of the last one.
+        // Returns false and sets `err` on a run-time error.
+        bool run(const Chunk& chunk, Value& result, std::string& err);
+        // The same by walking the tree directly, for comparison.
+        bool eval_tree(AST::Program* prog, Value& result, std::string& err);
+    };
+
+    std::string to_string(Value v);
+}
+
+#endif
@@ -0,0 +1,39 @@
+#include "writer.hpp"
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+
+Writer::Writer() {}
+
+Writer::Writer(int fd) : fd(fd) {
+    buf.reserve(capacity + 4096);
+}
+
+void Writer::put_int(int64_t value) {
+    char tmp[24];
+    buf.append(tmp, std::to_chars(tmp, tmp + sizeof tmp, value).ptr);
+    if (buf.size() >= capacity)
+        flush();
+}
+
+void Writer::flush() {
+    if (fd < 0)
+        return;
+    const char* p = buf.data();
+    std::size_t left = buf.size();
+    while (left && m_error.empty()) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            m_error = std::strerror(errno);
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    written += buf.size();
+    buf.clear();
+}
@@ -0,0 +1,49 @@
+#ifndef WRITER_HPP
+#define WRITER_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Output through one large buffer. Appending is a copy into the buffer;
+// the buffer goes to the file descriptor in a single write(2) whenever it
+// fills up, so a generator can emit token by token at memory speed.
+// Without a file descriptor everything stays in the buffer.
+class Writer {
+    std::string buf;
+    int fd = -1;
+    std::string m_error;
+    std::size_t written = 0;
+public:
+    static constexpr std::size_t capacity = 1 << 20;
+
+    // Buffers in memory; see str().
+    Writer();
+    // Writes to `fd`, which stays owned by the caller.
+    explicit Writer(int fd);
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    ~Writer() { flush(); }
+
+    void put(char c) {
+        buf += c;
+        if (buf.size() >= capacity)
+            flush();
+    }
+    void put(std::string_view s) {
+        buf += s;
+        if (buf.size() >= capacity)
+            flush();
+    }
+    void put_int(int64_t value);
+
+    void flush();
+    // Empty unless a write failed; output after a failure is dropped.
+    const std::string& error() const { return m_error; }
+    // Bytes put so far.
+    std::size_t size() const { return written + buf.size(); }
+    // Without a file descriptor, the output.
+    const std::string& str() const { return buf; }
+};
+
+#endif
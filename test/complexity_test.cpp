@@ -0,0 +1,152 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include <unistd.h>
+#include "../src/parser.hpp"
+#include "../src/stats.hpp"
+#include "../src/incremental.hpp"
+
+// Adversarial inputs at growing sizes, each parsed by Parser in both modes
+// and by FlatParser, or put through a Document edit. The CPU time and the
+// bytes allocated are fitted to c * n^k over the sizes, and a k clearly
+// above 1 fails: untrusted input must not be able to make the front end
+// quadratic, or make it hang.
+
+// The work measured on one input, done under a Timer of `st`.
+using Work = std::function<void(const std::string& input, stats::Stats& st)>;
+
+static
+void parse(const std::string& input, stats::Stats& st) {
+    auto ignore = [](AST::FilePos, std::string) {};
+    stats::Timer t(&st, stats::PARSE);
+    delete Parser(input, ignore, ParseMode::STREAM).parse_program();
+    delete Parser(input, ignore, ParseMode::BUFFERED).parse_program();
+    FlatParser(input, ignore).parse_program();
+}
+
+// A string opened at the top of a Document and going on past the newline
+// changes how every line after it lexes.
+static
+void open_string(const std::string& input, stats::Stats& st) {
+    Document doc(input);
+    stats::Timer t(&st, stats::PARSE);
+    doc.apply({0, 0, "\"\\\n"});
+}
+
+struct Case {
+    const char* name;
+    std::size_t base; // units at the smallest size
+    std::function<std::string(std::size_t)> gen;
+    Work work = parse;
+};
+
+static
+std::string repeat(std::string_view s, std::size_t n) {
+    std::string out;
+    out.reserve(s.size() * n);
+    for (std::size_t i = 0; i < n; i++)
+        out += s;
+    return out;
+}
+
+struct Sample {
+    double cpu;
+    double bytes;
+};
+
+static
+Sample measure(const std::string& input, const Work& work) {
+    Sample best = {INFINITY, 0};
+    for (int rep = 0; rep < 3; rep++) {
+        stats::Stats st;
+        work(input, st);
+        const stats::PhaseStats& p = st.phases[stats::PARSE];
+        best = {std::min(best.cpu, p.cpu), double(p.allocs.bytes)};
+    }
+    return best;
+}
+
+// The slope of the least squares line through (log n, log y).
+static
+double exponent(const std::vector<double>& n, const std::vector<double>& y) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (std::size_t i = 0; i < n.size(); i++) {
+        double lx = std::log(n[i]), ly = std::log(y[i]);
+        sx += lx;
+        sy += ly;
+        sxx += lx * lx;
+        sxy += lx * ly;
+    }
+    double k = n.size();
+    return (k * sxy - sx * sy) / (k * sxx - sx * sx);
+}
+
+static const char* running; // the case, for timed_out()
+
+static
+void timed_out(int) {
+    const char msg[] = "[ERROR] complexity: timed out, something hangs or is far too slow: ";
+    write(1, msg, sizeof msg - 1);
+    write(1, running, std::strlen(running));
+    write(1, "\n", 1);
+    _exit(1);
+}
+
+int main() {
+    std::signal(SIGALRM, timed_out);
+
+    Case cases[] = {
+        // A diagnostic on every line, from the parser and from the lexer.
+        {"errors", 1 << 12, [](std::size_t n) { return repeat(") @ 1 +\n\"s\n", n); }},
+        // Every diagnostic on one line, so columns are far into it.
+        {"one line errors", 1 << 16, [](std::size_t n) { return repeat("@", n) + "\n"; }},
+        // Recovery skips the rest of the statement token by token.
+        {"recovery", 1 << 14, [](std::size_t n) { return ")" + repeat(" x", n) + "\n"; }},
+        // Unbalanced braces: each '{' is an invalid expression, each '}'
+        // ends a statement list.
+        {"braces", 1 << 12, [](std::size_t n) { return repeat("{ x\n", n) + repeat("}\n", n); }},
+        // A tree n deep on the left, and operators waiting on the stack
+        // at every step.
+        {"left nesting", 1 << 13, [](std::size_t n) { return "x" + repeat(" - x", n) + "\n"; }},
+        {"waiting operators", 1 << 12, [](std::size_t n) { return "x" + repeat(" || y && - z == ! w", n) + "\n"; }},
+        {"unterminated string", 1 << 19, [](std::size_t n) { return "\"" + repeat("a", n); }},
+        {"unterminated strings", 1 << 12, [](std::size_t n) { return repeat("x \"ab\n", n); }},
+        {"unterminated comment", 1 << 20, [](std::size_t n) { return "x // " + repeat("c", n); }},
+        // Up to 10^6 prefix operators.
+        {"unary", 125000, [](std::size_t n) { return repeat("- ", n) + "x\n"; }},
+        {"binary", 1 << 12, [](std::size_t n) { return "x" + repeat(" + ! y * 2", n) + "\n"; }},
+        // Each line opens a string that the next one closes.
+        {"document string", 1 << 14, [](std::size_t n) { return repeat("a\"\\\n", n); }, open_string},
+    };
+
+    int failed = 0;
+    for (const Case& c : cases) {
+        running = c.name;
+        alarm(60);
+        std::vector<double> sizes, cpu, bytes;
+        for (std::size_t n = c.base; n <= c.base * 8; n *= 2) {
+            std::string input = c.gen(n);
+            Sample s = measure(input, c.work);
+            sizes.push_back(input.size());
+            cpu.push_back(std::max(s.cpu, 1e-6));
+            bytes.push_back(std::max(s.bytes, 1.0));
+        }
+        double kt = exponent(sizes, cpu), km = exponent(sizes, bytes);
+        std::printf("%-22s %8.0f KiB %8.1f ms   time n^%.2f   memory n^%.2f\n", c.name,
+                    sizes.back() / 1024, cpu.back() * 1e3, kt, km);
+        std::fflush(stdout);
+        // Room for timing noise, but far below quadratic.
+        if (kt > 1.3 || km > 1.15) {
+            std::cout << "[ERROR] complexity: " << c.name << " grows faster than linear\n";
+            failed++;
+        }
+    }
+    if (failed)
+        return 1;
+    std::cout << "COMPLEXITY tests passed successfully.\n";
+}
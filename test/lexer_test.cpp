@@ -1,5 +1,9 @@
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include "../src/lexer.hpp"
+#include "../src/thread_pool.hpp"
 
 int main() {
     std::string input = "let x = 11\n"
@@ -8,9 +12,10 @@ int main() {
                         "if x == y && x + y < 200 || 1 == 1 {\n"
                         "println(\"hello world\") // some inline comment\n"
                         "for x in arr {println(\"Found x right here {}\", x)}\n"
-                        "< > <= >= != ==\n";
+                        "< > <= >= != ==\n"
+                        "return lets fun_ continue\n";
     Lexer lex(input, [](AST::FilePos pos, std::string msg) {
-        printf("%lld:%lld %s\n", pos.row, pos.col, msg.c_str());
+        printf("%zu:%zu %s\n", pos.row, pos.col, msg.c_str());
         std::exit(0);
     });
     struct Test { 
@@ -71,6 +76,11 @@ int main() {
         {Token::NOTEQ, ""},
         {Token::EQUAL, ""},
         {Token::NEWLINE, ""},
+        {Token::RETURN, "return"},
+        {Token::IDENT, "lets"},
+        {Token::IDENT, "fun_"},
+        {Token::CONTINUE, "continue"},
+        {Token::NEWLINE, ""},
         {Token::ENDMARKER, ""},
     };
     int i = 0;
@@ -93,5 +103,154 @@ int main() {
         }
         i++; 
     }
+
+    // The buffered token stream has to match the streamed one exactly.
+    Lexer stream(input, [](AST::FilePos, std::string) {});
+    TokenBuffer buf = Lexer(input, [](AST::FilePos, std::string) {}).tokenize();
+    for (std::size_t j = 0; j < buf.size(); j++) {
+        LexTok want = stream.nextToken(), got = buf.get(j);
+        if (want.type != got.type || want.literal != got.literal || want.pos != got.pos ||
+            std::memcmp(&want.value, &got.value, sizeof want.value) != 0) {
+            std::cout << "[ERROR] token buffer differs at token " << j << "\n";
+            return 1;
+        }
+    }
+    // Lexing in parallel chunks has to give the same tokens and errors, also
+    // when strings, comments and newline runs cross the chunk boundaries.
+    std::string tricky;
+    for (int j = 0; j < 50; j++)
+        tricky += input + "\"multi\\\nline\" // comment \"\n\n\n\"open\n1e+\n";
+    std::vector<std::string> seq_errs, par_errs;
+    TokenBuffer seq = Lexer(tricky, [&](AST::FilePos pos, std::string msg) {
+        seq_errs.push_back(std::to_string(pos.row) + ":" + std::to_string(pos.col) + msg);
+    }).tokenize();
+    ThreadPool pool(4);
+    TokenBuffer par = Lexer(tricky, [&](AST::FilePos pos, std::string msg) {
+        par_errs.push_back(std::to_string(pos.row) + ":" + std::to_string(pos.col) + msg);
+    }).tokenize(pool, 7);
+    if (seq.size() != par.size() || seq_errs != par_errs) {
+        std::cout << "[ERROR] parallel tokenize differs: " << par.size() << " tokens, "
+                  << par_errs.size() << " errors; want " << seq.size() << ", " << seq_errs.size() << "\n";
+        return 1;
+    }
+    for (std::size_t j = 0; j < seq.size(); j++) {
+        LexTok want = seq.get(j), got = par.get(j);
+        if (want.type != got.type || want.literal != got.literal || want.pos != got.pos ||
+            std::memcmp(&want.value, &got.value, sizeof want.value) != 0) {
+            std::cout << "[ERROR] parallel tokenize differs at token " << j << "\n";
+            return 1;
+        }
+    }
+
+    // Number literals carry their values, in every base and with '_'
+    // separators; hex floats are exact.
+    {
+        std::string numbers = "0 1_000 0b1010 0o17 0x1F_ff 0123 12345678901234567 9223372036854775807 "
+                              "1.5 2e3 1_0.2_5 0x1.8p3 0x.1p-2 1e-400 "
+                              "9223372036854775808 1e999 0x 1__0 1_ 1p3 0b1e3\n";
+        std::vector<std::string> errs;
+        TokenBuffer toks = Lexer(numbers, [&](AST::FilePos pos, std::string msg) {
+            errs.push_back(std::to_string(pos.col) + " " + msg);
+        }).tokenize();
+        int64_t ints[] = {0, 1000, 10, 15, 0x1Fff, 123, 12345678901234567, INT64_MAX};
+        double floats[] = {1.5, 2e3, 10.25, 12.0, 0x.1p-2, 0.0};
+        std::size_t n = 0;
+        for (int64_t want : ints) {
+            LexTok t = toks.get(n++);
+            if (t.type != Token::INT || t.value.i != want) {
+                std::cout << "[ERROR] integer " << t.literal << ": want " << want << " got " << t.value.i << "\n";
+                return 1;
+            }
+        }
+        for (double want : floats) {
+            LexTok t = toks.get(n++);
+            if (t.type != Token::FLOAT || t.value.f != want) {
+                std::cout << "[ERROR] float " << t.literal << ": want " << want << " got " << t.value.f << "\n";
+                return 1;
+            }
+        }
+        std::vector<std::string> want_errs = {
+            "104 float out of range", "111 integer out of range", "131 float out of range",
+            "137 invalid integer", "141 '_' must separate digits", "146 '_' must separate digits",
+            "148 invalid float", "152 invalid float",
+        };
+        for (std::string& e : want_errs)
+            e.insert(e.find(' ') + 1, "Lexer Error: ");
+        if (errs != want_errs) {
+            std::cout << "[ERROR] number errors:\n";
+            for (const std::string& e : errs)
+                std::cout << "  " << e << "\n";
+            return 1;
+        }
+    }
+
+    // Every scanner the CPU supports stops where the scalar one does, with
+    // the stopping byte anywhere in buffers of 0 to 64 bytes, the last one
+    // included, and lexes the same tokens.
+    {
+        struct Run {
+            const char* name;
+            scan::Scanner fn;
+            char fill;
+            std::string stops;
+        };
+        Run runs[] = {
+            {"space", scan::space, '\t', "x\n"},
+            {"ident", scan::ident, '_', " -\x80"},
+            {"line", scan::line, 'a', "\n"},
+            {"string", scan::string, 'a', std::string("\"\\\n\0", 4)},
+        };
+        std::string source = "let x_1 = 12 + 3.5 // note\n\"a\\\"b\" != y\t\r\n!z && w || \"open\n_9 <= 0x1f @";
+        auto lex = [](std::string_view input) {
+            std::vector<std::string> out;
+            TokenBuffer toks = Lexer(input, [&](AST::FilePos pos, std::string msg) {
+                out.push_back(std::to_string(pos.col) + " " + msg);
+            }).tokenize();
+            for (std::size_t i = 0; i < toks.size(); i++) {
+                LexTok t = toks.get(i);
+                out.push_back(std::to_string(int(t.type)) + "@" + std::to_string(t.pos) + " " + std::string(t.literal));
+            }
+            return out;
+        };
+
+        scan::Impl was = scan::active();
+        scan::select(scan::Impl::SCALAR);
+        std::vector<std::vector<std::string>> want;
+        for (std::size_t len = 0; len <= 64; len++)
+            want.push_back(lex(source.substr(0, len)));
+
+        for (scan::Impl impl : {scan::Impl::SCALAR, scan::Impl::SSE2, scan::Impl::AVX2}) {
+            if (!scan::select(impl))
+                continue;
+            for (const Run& r : runs) {
+                for (std::size_t len = 0; len <= 64; len++) {
+                    // An exact-size heap buffer, so reading past it shows up
+                    // under a sanitizer.
+                    std::unique_ptr<char[]> buf(new char[len + 1]);
+                    for (std::size_t stop = 0; stop <= len; stop++) {
+                        for (char c : r.stops) {
+                            std::fill(buf.get(), buf.get() + len, r.fill);
+                            if (stop < len)
+                                buf[stop] = c;
+                            const char* got = r.fn(buf.get(), buf.get() + len);
+                            if (got != buf.get() + stop) {
+                                std::cout << "[ERROR] scanner " << int(impl) << " " << r.name << ": length " << len
+                                          << ", stop at " << stop << ", got " << got - buf.get() << "\n";
+                                return 1;
+                            }
+                        }
+                    }
+                }
+            }
+            for (std::size_t len = 0; len <= 64; len++) {
+                if (lex(source.substr(0, len)) != want[len]) {
+                    std::cout << "[ERROR] scanner " << int(impl) << ": tokens differ for length " << len << "\n";
+                    return 1;
+                }
+            }
+        }
+        scan::select(was);
+    }
+
     std::cout << "LEXER tests passed successfully.\n";
 }
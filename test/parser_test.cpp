@@ -1,5 +1,751 @@
+#include <iostream>
 #include "../src/parser.hpp"
+#include "../src/thread_pool.hpp"
+#include "../src/printer.hpp"
+#include "../src/visitor.hpp"
+#include "../src/codegen.hpp"
+#include "../src/vm.hpp"
+#include "../src/incremental.hpp"
+#include "../src/cache.hpp"
+#include "../src/stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <dirent.h>
+#include <unistd.h>
 
 int main() {
-    Parser* parser();
-}
\ No newline at end of file
+    std::string input = "1 + 2 * -x - \"s\" < y || 3.5 && !z\n"
+                        "\n"
+                        "a; b // comment\n";
+    auto on_error = [](AST::FilePos pos, std::string msg) {
+        printf("%zu:%zu %s\n", pos.row, pos.col, msg.c_str());
+        std::exit(1);
+    };
+    std::string want = "1 + 2 * - x - s < y || 3.500000 && ! z\n"
+                       "a\n"
+                       "b\n";
+
+    for (ParseMode mode : {ParseMode::STREAM, ParseMode::BUFFERED}) {
+        Parser parser(input, on_error, mode);
+        AST::Program* prog = parser.parse_program();
+        if (prog->string() != want) {
+            std::cout << "[ERROR] tree: want '" << want << "' got '" << prog->string() << "'\n";
+            return 1;
+        }
+        delete prog;
+
+        FlatParser flat_parser(input, on_error, mode);
+        AST::Flat::Tree tree = flat_parser.parse_program();
+        if (tree.string() != want) {
+            std::cout << "[ERROR] flat tree: want '" << want << "' got '" << tree.string() << "'\n";
+            return 1;
+        }
+    }
+    // The compact format, for both trees.
+    {
+        std::string want = "(|| (< (- (+ 1 (* 2 (- x))) \"s\") y) (&& 3.5 (! z)))\n"
+                           "a\n"
+                           "(bad)\n";
+        std::string input = "1 + 2 * -x - \"s\" < y || 3.5 && !z\na\n)\n";
+        auto ignore = [](AST::FilePos, std::string) {};
+        AST::Program* prog = Parser(input, ignore).parse_program();
+        AST::Printer printer(AST::PrintFormat::COMPACT);
+        printer.print(prog);
+        delete prog;
+        AST::Printer flat_printer(AST::PrintFormat::COMPACT);
+        flat_printer.print(FlatParser(input, ignore).parse_program());
+        if (printer.str() != want || flat_printer.str() != want) {
+            std::cout << "[ERROR] compact: want '" << want << "' got '" << printer.str()
+                      << "' and '" << flat_printer.str() << "'\n";
+            return 1;
+        }
+    }
+
+    // Visitor dispatch, and a walk over a tree far deeper than the native
+    // stack could recurse through.
+    {
+        struct Count : AST::Visitor<Count, int> {
+            int visit_node(AST::Node*) { return 1; }
+            int visit_program(AST::Program* n) {
+                int c = 0;
+                for (AST::Stmt* s : n->stmts) c += visit(s);
+                return c;
+            }
+            int visit_stmt_expr(AST::StmtExpr* n) { return 1 + visit(n->expr); }
+            int visit_unary(AST::ExprUnary* n) { return 1 + visit(n->right); }
+            int visit_binary(AST::ExprBinary* n) { return 1 + visit(n->left) + visit(n->right); }
+        };
+        auto ignore = [](AST::FilePos, std::string) {};
+        AST::Program* prog = Parser("1 + -x * y\nz\n", ignore).parse_program();
+        if (int n = Count().visit(prog); n != 9) {
+            std::cout << "[ERROR] visitor: want 9 nodes got " << n << '\n';
+            return 1;
+        }
+        delete prog;
+
+        const std::size_t depth = 1000000;
+        AST::TreeBuilder build;
+        build.begin("");
+        AST::Expr* x = build.ident(0, "x");
+        for (std::size_t i = 0; i < depth; i++)
+            x = build.unary(0, Token::SUB, x);
+        prog = build.finish({build.stmt_expr(0, x)});
+
+        struct Depth : AST::Walker<Depth> {
+            std::size_t cur = 0, max = 0;
+            bool pre(AST::Node*) { max = std::max(max, ++cur); return true; }
+            void post(AST::Node*) { cur--; }
+        } d;
+        d.walk(prog);
+        std::string s = prog->string();
+        if (d.max != depth + 3 || d.cur != 0 || s.size() != 2 * depth + 2) {
+            std::cout << "[ERROR] deep walk: depth " << d.max << ", printed " << s.size() << " bytes\n";
+            return 1;
+        }
+        delete prog;
+    }
+
+    // Expressions are parsed without recursion, so prefix chains can be a
+    // million deep; precedence and left grouping are kept.
+    {
+        auto ignore = [](AST::FilePos, std::string) {};
+        AST::Printer compact(AST::PrintFormat::COMPACT);
+        AST::Program* prog = Parser("a - b - c * d / - ! e < f || g && h\n", ignore).parse_program();
+        compact.print(prog);
+        delete prog;
+        if (compact.str() != "(|| (< (- (- a b) (/ (* c d) (- (! e)))) f) (&& g h))\n") {
+            std::cout << "[ERROR] precedence: got " << compact.str();
+            return 1;
+        }
+
+        const std::size_t depth = 1000000, n = 100000;
+        std::string input;
+        for (std::size_t i = 0; i < depth; i++)
+            input += "- ";
+        input += "x";
+        for (std::size_t i = 0; i < n; i++)
+            input += i % 2 ? " * ! y" : " + y";
+        input += "\n";
+        prog = Parser(input, ignore).parse_program();
+        AST::Flat::Tree tree = FlatParser(input, ignore).parse_program();
+        // A statement, x under its prefix chain, and n binary operators with
+        // a y each, every other one under a '!'.
+        if (tree.size() != 1 + (depth + 1) + 2 * n + n / 2 || tree.string() != prog->string()) {
+            std::cout << "[ERROR] long expression: " << tree.size() << " nodes\n";
+            return 1;
+        }
+        delete prog;
+    }
+
+    // Constant folding, with overflow and division by zero reported and
+    // left unfolded.
+    {
+        std::string input = "1 + 2 * 3 - -4\n"
+                            "1 < 2.5 && !0\n"
+                            "x + 2 * 3\n"
+                            "7 / 2 + 1.0 / 4\n"
+                            "1 / 0\n"
+                            "9223372036854775807 + 1\n";
+        std::string want = "11\n"
+                           "1\n"
+                           "x + 6\n"
+                           "3.250000\n"
+                           "1 / 0\n"
+                           "9223372036854775807 + 1\n";
+        std::vector<std::string> errors;
+        auto collect = [&](AST::FilePos pos, std::string msg) {
+            errors.push_back(std::to_string(pos.row) + ":" + std::to_string(pos.col) + " " + msg);
+        };
+        Parser parser(input, collect);
+        parser.set_folding(true);
+        AST::Program* prog = parser.parse_program();
+        FlatParser flat_parser(input, collect);
+        flat_parser.set_folding(true);
+        AST::Flat::Tree tree = flat_parser.parse_program();
+        if (prog->string() != want || tree.string() != want) {
+            std::cout << "[ERROR] folding: want '" << want << "' got '" << prog->string()
+                      << "' and '" << tree.string() << "'\n";
+            return 1;
+        }
+        std::vector<std::string> want_errors;
+        for (int tree = 0; tree < 2; tree++) {
+            want_errors.push_back("5:3 division by zero in constant expression");
+            want_errors.push_back("6:21 integer overflow in constant expression");
+        }
+        if (errors != want_errors) {
+            std::cout << "[ERROR] folding diagnostics:\n";
+            for (const std::string& e : errors)
+                std::cout << e << '\n';
+            return 1;
+        }
+        // 6 statements, 3 folded literals, 3 nodes each for the rest
+        if (tree.size() != 6 + 3 + 3 * 3) {
+            std::cout << "[ERROR] folding left " << tree.size() << " nodes\n";
+            return 1;
+        }
+        delete prog;
+    }
+
+    // C output, the same from both trees.
+    {
+        std::string input = "1 + -x * 2.0\n- -5\ny || \"s\\n\"\nx\n";
+        std::string want = "#include <math.h>\n"
+                           "#include <stdint.h>\n"
+                           "\n"
+                           "static int64_t pd_x;\n"
+                           "static int64_t pd_y;\n"
+                           "\n"
+                           "int main(void) {\n"
+                           "    (void)(1LL + ((-pd_x) * 2.0));\n"
+                           "    (void)(-(-5LL));\n"
+                           "    (void)(pd_y || \"s\\n\");\n"
+                           "    (void)pd_x;\n"
+                           "    return 0;\n"
+                           "}\n";
+        AST::Program* prog = Parser(input, on_error).parse_program();
+        Writer out, flat_out;
+        codegen::emit_c(prog, out);
+        codegen::emit_c(FlatParser(input, on_error).parse_program(), flat_out);
+        delete prog;
+        if (out.str() != want || flat_out.str() != want) {
+            std::cout << "[ERROR] C: want '" << want << "' got '" << out.str()
+                      << "' and '" << flat_out.str() << "'\n";
+            return 1;
+        }
+    }
+
+    // The VM and the tree evaluator agree, on values and on errors.
+    {
+        struct Case {
+            std::string input;
+            std::string want; // the value, or the error
+        };
+        Case cases[] = {
+            {"x * 2 + -y\n", "11"},
+            {"7 / 2 * 1.5\n", "4.500000"},
+            {"x < 3.5 && !y || 0\n", "0"},
+            {"x < 10 && y > 2\n", "1"},
+            {"0 && 1 / 0\n", "0"},
+            {"1 || 1 / 0\n", "1"},
+            {"1\n0 || x / 0 * y\n", "division by zero"},
+            {"9223372036854775807 + x\n", "integer overflow"},
+            {"- - 2.5 * x\n", "17.500000"},
+            {"\"s\"\n", "strings are not supported"},
+        };
+        auto ignore = [](AST::FilePos, std::string) {};
+        for (const Case& c : cases) {
+            AST::Program* prog = Parser(c.input, ignore).parse_program();
+            vm::Machine machine;
+            machine.set_global(SymbolTable::global().intern("x"), 7);
+            machine.set_global(SymbolTable::global().intern("y"), 3);
+
+            std::string got[2];
+            vm::Value value;
+            vm::Chunk chunk;
+            std::string err;
+            if (vm::compile(prog, chunk, err) && machine.run(chunk, value, err))
+                got[0] = vm::to_string(value);
+            else
+                got[0] = err;
+            err.clear();
+            got[1] = machine.eval_tree(prog, value, err) ? vm::to_string(value) : err;
+            delete prog;
+            if (got[0] != c.want || got[1] != c.want) {
+                std::cout << "[ERROR] eval '" << c.input << "': want " << c.want
+                          << " got " << got[0] << " (vm) and " << got[1] << " (tree)\n";
+                return 1;
+            }
+        }
+    }
+
+    // Incremental updates give the same trees and diagnostics as parsing
+    // the edited text from scratch.
+    {
+        const char* snippets[] = {
+            "x + 1\n", "a * b - c\n", "\n", "// note\n", "{ y\n", "}\n", "1 +\n",
+            "\"str\"\n", "z; w\n", "3.5 < q\n", ")\n", "\"open\n", "!\n", "&",
+            // strings that go on past a newline
+            "\"a\\\n", "b\"\\\n",
+        };
+        uint64_t seed = 12345;
+        auto rnd = [&](uint64_t n) {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            return (seed >> 33) % n;
+        };
+        auto whole = [](const std::string& text, std::string& tree, std::vector<std::string>& diags) {
+            diags.clear();
+            auto report = [&](AST::FilePos pos, std::string msg) {
+                diags.push_back(std::to_string(pos.row) + ":" + std::to_string(pos.col) + " " + msg);
+            };
+            AST::Program* prog = Parser(text, report).parse_program();
+            tree = prog->string();
+            delete prog;
+            std::stable_sort(diags.begin(), diags.end(), [](const std::string& a, const std::string& b) {
+                return std::pair(std::stoi(a), std::stoi(a.substr(a.find(':') + 1))) <
+                       std::pair(std::stoi(b), std::stoi(b.substr(b.find(':') + 1)));
+            });
+        };
+
+        std::string text;
+        for (int i = 0; i < 200; i++)
+            text += snippets[rnd(std::size(snippets))];
+        Document doc(text, 64);
+        for (int round = 0; round < 500; round++) {
+            std::size_t offs = rnd(text.size() + 1);
+            std::size_t removed = rnd(4) ? rnd(20) : rnd(400);
+            removed = std::min(removed, text.size() - offs);
+            std::string inserted;
+            for (int n = rnd(4); n > 0; n--)
+                inserted += snippets[rnd(std::size(snippets))];
+            text.replace(offs, removed, inserted);
+            doc.apply({offs, removed, inserted});
+
+            std::string want_tree, got_tree;
+            std::vector<std::string> want_diags, got_diags;
+            whole(text, want_tree, want_diags);
+            for (std::size_t i = 0; i < doc.chunks(); i++)
+                got_tree += doc.chunk_tree(i)->string();
+            for (const Document::Diagnostic& d : doc.diagnostics())
+                got_diags.push_back(std::to_string(d.pos.row) + ":" + std::to_string(d.pos.col) + " " + d.msg);
+            if (doc.text() != text || got_tree != want_tree || got_diags != want_diags) {
+                std::cout << "[ERROR] incremental round " << round << ": edit at " << offs
+                          << " removing " << removed << " inserting '" << inserted << "'\n";
+                return 1;
+            }
+        }
+    }
+
+    // An edit re-parses only the chunks around it, also when it leaves a
+    // brace open: '{' is an invalid expression and '}' ends a statement
+    // list, so neither reaches past its line.
+    {
+        std::string text;
+        for (int i = 0; i < 10000; i++)
+            text += "a * b + " + std::to_string(i) + "\n";
+        const std::size_t chunk = 1024;
+        Document doc(text, chunk);
+        std::size_t mid = text.size() / 2;
+        doc.apply({0, 0, "{\n"});
+        std::size_t at_top = doc.last_reparsed();
+        doc.apply({mid, 0, "{ c\n"});
+        std::size_t in_middle = doc.last_reparsed();
+        doc.apply({mid + 4, 0, "- 2"});
+        text.insert(0, "{\n");
+        text.insert(mid, "{ c\n- 2");
+        if (at_top > 3 * chunk || in_middle > 3 * chunk || doc.last_reparsed() > 3 * chunk ||
+            doc.text() != text) {
+            std::cout << "[ERROR] incremental edits re-parsed " << at_top << ", " << in_middle << " and "
+                      << doc.last_reparsed() << " bytes\n";
+            return 1;
+        }
+    }
+
+    // An edit that opens a string going on past a newline changes how the
+    // chunks after it lex. They are taken in until the tokens are back in
+    // step, lexing the text a bounded number of times over, however far
+    // that is.
+    {
+        auto diags = [](const std::vector<Document::Diagnostic>& ds) {
+            std::vector<std::string> out;
+            for (const Document::Diagnostic& d : ds)
+                out.push_back(std::to_string(d.pos.row) + ":" + std::to_string(d.pos.col) + " " + d.msg);
+            return out;
+        };
+        auto whole = [&](const std::string& text) {
+            std::vector<Document::Diagnostic> ds;
+            delete Parser(text, [&](AST::FilePos pos, std::string msg) { ds.push_back({pos, msg}); }).parse_program();
+            std::stable_sort(ds.begin(), ds.end(), [](const Document::Diagnostic& a, const Document::Diagnostic& b) {
+                return a.pos.row != b.pos.row ? a.pos.row < b.pos.row : a.pos.col < b.pos.col;
+            });
+            return diags(ds);
+        };
+
+        Document small("x\np\" \"\\\nz\"\n", 1);
+        small.apply({1, 0, "\"\\"});
+        if (diags(small.diagnostics()) != whole(small.text())) {
+            std::cout << "[ERROR] incremental: string opened past a newline\n";
+            return 1;
+        }
+
+        // Each line opens a string that the next one closes, so a line put
+        // in at the top turns every line after it inside out.
+        std::string text;
+        for (int i = 0; i < 65536; i++)
+            text += "a\"\\\n";
+        const std::size_t chunk = 4096;
+        Document doc(text, chunk);
+        stats::Stats st;
+        stats::Timer t(&st, stats::LEX);
+        doc.apply({0, 0, "\"\\\n"});
+        t.stop();
+        text.insert(0, "\"\\\n");
+        double per_byte = double(st.phases[stats::LEX].allocs.bytes) / text.size();
+        if (doc.text() != text || diags(doc.diagnostics()) != whole(text) || per_byte > 200 ||
+            doc.chunks() < text.size() / chunk) {
+            std::cout << "[ERROR] incremental string at the top: " << per_byte << " bytes allocated per byte, "
+                      << doc.chunks() << " chunks\n";
+            return 1;
+        }
+    }
+
+    // Cached trees load back with their diagnostics; entries are per folding
+    // mode, and ones that don't match the source or are damaged are parsed
+    // over again.
+    {
+        char dir[] = "/tmp/parser_test_cacheXXXXXX";
+        if (!mkdtemp(dir)) {
+            std::cout << "[ERROR] cache: no temporary directory\n";
+            return 1;
+        }
+        std::string input = "x + 1 * \"s\"\n2 * 3 + -y\n)\n1 / 0\n";
+        auto run = [&](cache::Cache& c, uint32_t flags, std::string& tree, std::vector<std::string>& diags) {
+            diags.clear();
+            bool hit = false;
+            AST::Program* prog = c.parse(input, flags, [&](AST::FilePos pos, std::string msg) {
+                diags.push_back(std::to_string(pos.row) + ":" + std::to_string(pos.col) + " " + msg);
+            }, nullptr, &hit);
+            tree = prog->string();
+            delete prog;
+            return hit;
+        };
+        cache::Cache c(dir);
+        std::string want_tree, tree;
+        std::vector<std::string> want_diags, diags;
+        Parser parser(input, [&](AST::FilePos pos, std::string msg) {
+            want_diags.push_back(std::to_string(pos.row) + ":" + std::to_string(pos.col) + " " + msg);
+        });
+        parser.set_folding(true);
+        AST::Program* prog = parser.parse_program();
+        want_tree = prog->string();
+        delete prog;
+
+        std::string unfolded_tree;
+        std::vector<std::string> unfolded_diags;
+        bool first = run(c, cache::FOLDED, tree, diags);
+        bool second = run(c, cache::FOLDED, tree, diags);
+        bool unfolded = run(c, 0, unfolded_tree, unfolded_diags);
+        if (first || !second || unfolded || tree != want_tree || diags != want_diags ||
+            unfolded_tree == want_tree) {
+            std::cout << "[ERROR] cache: hits " << first << second << unfolded << "\n" << tree;
+            return 1;
+        }
+
+        // A damaged entry is caught by its checks, a truncated one by its size.
+        std::string path = c.path(input, cache::FOLDED);
+        FILE* f = std::fopen(path.c_str(), "r+b");
+        std::fseek(f, 200, SEEK_SET);
+        std::fputc(0xff, f);
+        std::fclose(f);
+        bool damaged = run(c, cache::FOLDED, tree, diags);
+        truncate(path.c_str(), 100);
+        bool truncated = run(c, cache::FOLDED, tree, diags);
+        bool again = run(c, cache::FOLDED, tree, diags);
+        if (damaged || truncated || !again || tree != want_tree || diags != want_diags) {
+            std::cout << "[ERROR] cache: damaged entry used: " << damaged << truncated << again << "\n";
+            return 1;
+        }
+        std::remove(path.c_str());
+        std::remove(c.path(input, 0).c_str());
+        rmdir(dir);
+    }
+
+    // Threads writing the entry of the same source at once each write a
+    // temporary file of their own; the entry ends up whole and nothing is
+    // left behind.
+    {
+        char dir[] = "/tmp/parser_test_cacheXXXXXX";
+        if (!mkdtemp(dir)) {
+            std::cout << "[ERROR] cache: no temporary directory\n";
+            return 1;
+        }
+        std::string input;
+        for (int i = 0; i < 2000; i++)
+            input += "x + " + std::to_string(i) + " * y\n";
+        auto ignore = [](AST::FilePos, std::string) {};
+        cache::Cache c(dir);
+        ThreadPool pool(8);
+        AST::Flat::Tree tree = FlatParser(input, ignore).parse_program();
+        for (int round = 0; round < 5; round++) {
+            std::atomic<int> failed{0};
+            pool.run(16, [&](std::size_t) {
+                std::string err;
+                failed += !cache::write(c.path(input, 0), input, 0, tree, {}, err);
+            });
+            bool hit = false;
+            delete c.parse(input, 0, ignore, nullptr, &hit);
+            std::size_t files = 0;
+            DIR* d = opendir(dir);
+            while (dirent* e = readdir(d))
+                files += e->d_name[0] != '.';
+            closedir(d);
+            if (failed || !hit || files != 1) {
+                std::cout << "[ERROR] cache: concurrent writes: " << failed << " failed, " << files
+                          << " files left, hit " << hit << "\n";
+                return 1;
+            }
+            std::remove(c.path(input, 0).c_str());
+        }
+        rmdir(dir);
+    }
+
+    // Sharing: equal subtrees become one node, and the tree prints the same.
+    {
+        std::string input = "x + y < 200\nx + y < 200\n1 == 1\n1 == 1\n";
+        auto ignore = [](AST::FilePos, std::string) {};
+        AST::Program* plain = Parser(input, ignore).parse_program();
+        Parser parser(input, ignore);
+        parser.set_sharing(true);
+        AST::Program* prog = parser.parse_program();
+        if (!prog->shared || prog->string() != plain->string() ||
+            static_cast<AST::StmtExpr*>(prog->stmts[0])->expr != static_cast<AST::StmtExpr*>(prog->stmts[1])->expr ||
+            static_cast<AST::StmtExpr*>(prog->stmts[2])->expr != static_cast<AST::StmtExpr*>(prog->stmts[3])->expr) {
+            std::cout << "[ERROR] sharing: " << prog->string() << '\n';
+            return 1;
+        }
+        delete plain;
+        delete prog;
+
+        FlatParser flat_parser(input, ignore);
+        flat_parser.set_sharing(true);
+        AST::Flat::Tree tree = flat_parser.parse_program();
+        // 4 statements, x y + 200 < and 1 ==
+        if (tree.size() != 4 + 5 + 2 || tree.string() != FlatParser(input, ignore).parse_program().string()) {
+            std::cout << "[ERROR] sharing left " << tree.size() << " nodes\n";
+            return 1;
+        }
+
+        Parser folded(input, ignore);
+        folded.set_folding(true);
+        FlatParser both(input, ignore);
+        both.set_folding(true);
+        both.set_sharing(true);
+        prog = folded.parse_program();
+        if (both.parse_program().string() != prog->string()) {
+            std::cout << "[ERROR] sharing and folding\n";
+            return 1;
+        }
+        delete prog;
+
+        // Invalid expressions stay apart, each at the position of its error.
+        std::string bad = "x + @\nx + @\n";
+        Parser bad_parser(bad, ignore);
+        bad_parser.set_sharing(true);
+        prog = bad_parser.parse_program();
+        auto* first = static_cast<AST::ExprBinary*>(static_cast<AST::StmtExpr*>(prog->stmts[0])->expr);
+        auto* second = static_cast<AST::ExprBinary*>(static_cast<AST::StmtExpr*>(prog->stmts[1])->expr);
+        FlatParser bad_flat(bad, ignore);
+        bad_flat.set_sharing(true);
+        tree = bad_flat.parse_program();
+        AST::Flat::Ref rhs0 = tree.rhs(tree.lhs(tree.stmts[0])), rhs1 = tree.rhs(tree.lhs(tree.stmts[1]));
+        if (first == second || first->right->pos() != 4 || second->right->pos() != 10 ||
+            rhs0 == rhs1 || tree.pos[rhs0] != 4 || tree.pos[rhs1] != 10) {
+            std::cout << "[ERROR] sharing invalid expressions\n";
+            return 1;
+        }
+        delete prog;
+    }
+
+    // Statistics: tokens by kind, nodes by type, and the allocations of a
+    // phase counted while its Timer runs.
+    {
+        auto ignore = [](AST::FilePos, std::string) {};
+        stats::Stats st;
+        stats::Timer lex(&st, stats::LEX);
+        TokenBuffer toks = Lexer("a + 1\n- b\n", ignore).tokenize();
+        lex.stop();
+        st.count_tokens(toks);
+        stats::Timer parse(&st, stats::PARSE);
+        AST::Program* prog = Parser(std::move(toks), ignore).parse_program();
+        parse.stop();
+        st.count_nodes(prog);
+        delete prog;
+        uint64_t allocs = st.phases[stats::PARSE].allocs.count;
+        delete new int(0); // after stop(), not counted
+        if (st.tokens[int(Token::IDENT)] != 2 || st.tokens[int(Token::NEWLINE)] != 2 ||
+            st.nodes[AST::EXPR_BINARY] != 1 || st.nodes[AST::EXPR_UNARY] != 1 || st.nodes[AST::STMT_EXPR] != 2 ||
+            st.phases[stats::LEX].allocs.count == 0 || allocs == 0 ||
+            st.phases[stats::PARSE].allocs.count != allocs || stats::json(st, 0).find("\"+\": 1") == std::string::npos) {
+            std::cout << "[ERROR] stats:\n" << stats::table(st, 0);
+            return 1;
+        }
+    }
+
+    // Through the cache, a miss lexes on its own and counts the tokens; a
+    // hit counts none and says so.
+    {
+        char dir[] = "/tmp/parser_test_cacheXXXXXX";
+        if (!mkdtemp(dir)) {
+            std::cout << "[ERROR] cache: no temporary directory\n";
+            return 1;
+        }
+        auto ignore = [](AST::FilePos, std::string) {};
+        std::string input = "a + 1\n- b\n";
+        cache::Cache c(dir);
+        stats::Stats miss, hit;
+        delete c.parse(input, 0, ignore, nullptr, nullptr, &miss);
+        delete c.parse(input, 0, ignore, nullptr, nullptr, &hit);
+        if (miss.tokens[int(Token::IDENT)] != 2 || miss.uncounted != 0 ||
+            miss.phases[stats::LEX].allocs.count == 0 || miss.phases[stats::PARSE].allocs.count == 0 ||
+            hit.tokens[int(Token::IDENT)] != 0 || hit.uncounted != 1 ||
+            stats::table(hit, 0).find("not counted for 1 files") == std::string::npos ||
+            stats::json(hit, 0).find("\"uncounted_files\": 1") == std::string::npos) {
+            std::cout << "[ERROR] stats through the cache:\n" << stats::table(miss, 0) << stats::table(hit, 0);
+            return 1;
+        }
+        std::remove(c.path(input, 0).c_str());
+        rmdir(dir);
+    }
+
+    // Looking ahead gives the tokens after the current one, up to ENDMARKER
+    // and past it, in both modes, and doesn't change what is parsed.
+    {
+        auto ignore = [](AST::FilePos, std::string) {};
+        std::string input = "a + 1\n- b\n";
+        TokenBuffer toks = Lexer(input, ignore).tokenize();
+        AST::Program* plain = Parser(input, ignore).parse_program();
+        std::string want = plain->string();
+        delete plain;
+        for (ParseMode mode : {ParseMode::STREAM, ParseMode::BUFFERED}) {
+            Parser parser(input, ignore, mode);
+            for (std::size_t n = 1; n <= toks.size() + 2; n++) {
+                LexTok got = parser.peek(n);
+                LexTok exp = toks.get(std::min(n, toks.size() - 1));
+                if (got.type != exp.type || (n < toks.size() && got.pos != exp.pos)) {
+                    std::cout << "[ERROR] peek(" << n << ") in mode " << int(mode) << ": got " << got.type << "\n";
+                    return 1;
+                }
+            }
+            AST::Program* prog = parser.parse_program();
+            if (prog->string() != want) {
+                std::cout << "[ERROR] parse after peek in mode " << int(mode) << ": " << prog->string();
+                return 1;
+            }
+            delete prog;
+        }
+    }
+
+    // Printing to a stream writes in pieces of about flush_size, also when
+    // a single statement is far larger.
+    {
+        struct Pieces : std::streambuf {
+            std::size_t total = 0, largest = 0;
+            std::streamsize xsputn(const char*, std::streamsize n) override {
+                total += n;
+                largest = std::max<std::size_t>(largest, n);
+                return n;
+            }
+            int overflow(int c) override { total++; return c; }
+        } pieces;
+        std::ostream out(&pieces);
+        const std::size_t depth = 1000000;
+        AST::TreeBuilder build;
+        build.begin("");
+        AST::Expr* x = build.ident(0, "x");
+        for (std::size_t i = 0; i < depth; i++)
+            x = build.unary(0, Token::SUB, x);
+        AST::Program* prog = build.finish({build.stmt_expr(0, x)});
+        {
+            AST::Printer printer(out);
+            printer.print(prog);
+        }
+        delete prog;
+        if (pieces.total != 2 * depth + 2 || pieces.largest > AST::Printer::flush_size + 16) {
+            std::cout << "[ERROR] streamed printing: " << pieces.total << " bytes, largest write "
+                      << pieces.largest << "\n";
+            return 1;
+        }
+    }
+
+    // An exception while parsing reaches the caller, also through a
+    // ThreadPool, instead of ending the process.
+    {
+        auto fail = [](AST::FilePos, std::string msg) { throw std::runtime_error(msg); };
+        ThreadPool pool(2);
+        for (ParseMode mode : {ParseMode::STREAM, ParseMode::BUFFERED}) {
+            std::string caught;
+            try {
+                pool.run(1, [&](std::size_t) { delete Parser("x\n)\n", fail, mode).parse_program(); });
+            } catch (const std::runtime_error& e) {
+                caught = e.what();
+            }
+            if (caught != "invalid expression") {
+                std::cout << "[ERROR] exception from parse_program: got '" << caught << "'\n";
+                return 1;
+            }
+        }
+    }
+
+    // A NUL byte is an error wherever it is, also in a string, and the
+    // rest of the input is still parsed; only the end of the input ends it.
+    {
+        std::string nul("x\0 y\n\"a\0b\" + 1\nz\n\0", 18);
+        std::vector<std::string> want_errs = {
+            "1:2 Lexer Error: unexpected NUL byte", "1:2 expected newline",
+            "2:3 Lexer Error: unexpected NUL byte",
+            "4:1 Lexer Error: unexpected NUL byte", "4:1 invalid expression",
+        };
+        for (ParseMode mode : {ParseMode::STREAM, ParseMode::BUFFERED}) {
+            std::vector<std::string> errs;
+            Parser parser(nul, [&](AST::FilePos pos, std::string msg) {
+                errs.push_back(std::to_string(pos.row) + ":" + std::to_string(pos.col) + " " + msg);
+            }, mode);
+            AST::Program* prog = parser.parse_program();
+            std::sort(errs.begin(), errs.end());
+            AST::Printer printer(AST::PrintFormat::COMPACT);
+            printer.print(prog);
+            delete prog;
+            if (errs != want_errs || printer.take() != std::string("x\n(+ \"a\0b\" 1)\nz\n(bad)\n", 22)) {
+                std::cout << "[ERROR] NUL bytes in mode " << int(mode) << ":\n";
+                for (const std::string& e : errs)
+                    std::cout << "  " << e << "\n";
+                return 1;
+            }
+        }
+    }
+
+    // Identifiers are interned: the same name gives the same symbol, in
+    // both trees and across threads.
+    {
+        AST::Program* prog = Parser("abc + abd * abc\n", on_error).parse_program();
+        auto* bin = static_cast<AST::ExprBinary*>(static_cast<AST::StmtExpr*>(prog->stmts[0])->expr);
+        auto* mul = static_cast<AST::ExprBinary*>(bin->right);
+        Symbol a = static_cast<AST::IdentLit*>(bin->left)->name;
+        Symbol b = static_cast<AST::IdentLit*>(mul->left)->name;
+        Symbol c = static_cast<AST::IdentLit*>(mul->right)->name;
+        if (a != c || a == b || SymbolTable::global().spelling(b) != "abd") {
+            std::cout << "[ERROR] symbols: " << a << ' ' << b << ' ' << c << '\n';
+            return 1;
+        }
+        delete prog;
+
+        AST::Flat::Tree tree = FlatParser("abd\n", on_error).parse_program();
+        if (tree.symbol(tree.lhs(tree.stmts[0])) != b) {
+            std::cout << "[ERROR] flat tree symbol differs\n";
+            return 1;
+        }
+    }
+    {
+        SymbolTable table;
+        const std::size_t names = 20000;
+        std::vector<Symbol> syms(4 * names);
+        ThreadPool pool(4);
+        pool.run(syms.size(), [&](std::size_t i) {
+            syms[i] = table.intern("name" + std::to_string(i % names));
+        });
+        for (std::size_t i = 0; i < syms.size(); i++) {
+            if (syms[i] != syms[i % names] ||
+                table.spelling(syms[i]) != "name" + std::to_string(i % names)) {
+                std::cout << "[ERROR] concurrent intern of name" << i % names << '\n';
+                return 1;
+            }
+        }
+        if (table.size() != names) {
+            std::cout << "[ERROR] symbol table size: want " << names << " got " << table.size() << '\n';
+            return 1;
+        }
+    }
+    std::cout << "PARSER tests passed successfully.\n";
+}